@@ -0,0 +1,211 @@
+//
+// Created by paul on 10/19/26.
+//
+// Resumable runs. As inputs are completed, a small checkpoint file records
+// how many there have been, how far into stdin they reached, and digests of
+// the inputs and of the outputs generated for them. It is rewritten every
+// so often, via a temporary file that is synced and renamed over the old
+// one, so whatever is on disk is always a complete checkpoint.
+//
+// When a run starts with a checkpoint already in place, the inputs it
+// covers are read and hashed but not processed. If the digest of what was
+// skipped doesn't match the checkpoint, this isn't the same input, and the
+// run stops rather than guess. Once a run completes, the checkpoint file is
+// removed.
+//
+#define _XOPEN_SOURCE 700
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+#define kCheckpointEvery    256   // inputs
+#define kCheckpointInterval 5     // seconds
+
+typedef struct {
+    unsigned long long inputs;       // number of inputs completed
+    unsigned long long offset;       // bytes of stdin consumed by them
+    uint64_t           inputDigest;
+    uint64_t           outputDigest;
+} tCheckpoint;
+
+static string      gCheckpointPath = NULL;
+static tCheckpoint gCheckpoint;           // progress of this run
+static tCheckpoint gResumeFrom;           // what the checkpoint file said
+static time_t      gCheckpointWritten = 0;
+static unsigned    gSinceWritten = 0;
+
+static uint64_t digest( uint64_t hash, string s )
+{
+    // FNV-1a, including the terminating NUL so "ab","c" differs from "a","bc"
+    const unsigned char * p = (const unsigned char *)s;
+    do {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    } while ( *p++ != '\0' );
+    return hash;
+}
+
+static int writeCheckpoint( void )
+{
+    char temp[ PATH_MAX + 16 ];
+
+    // output for the inputs we're about to record as done must not be left sitting in a buffer
+    fflush( stdout );
+
+    snprintf( temp, sizeof(temp), "%s.tmp", gCheckpointPath );
+    FILE * file = fopen( temp, "w" );
+    if ( file == NULL )
+    {
+        fprintf( stderr, "### Error: Unable to create checkpoint \'%s\' (%d: %s)\n",
+                 temp, errno, strerror(errno) );
+        return errno;
+    }
+
+    fprintf( file, "inputs %llu\noffset %llu\ninput-digest %016llx\noutput-digest %016llx\n",
+             gCheckpoint.inputs, gCheckpoint.offset,
+             (unsigned long long)gCheckpoint.inputDigest, (unsigned long long)gCheckpoint.outputDigest );
+
+    // make sure it's really on disk before it replaces the previous one
+    if ( fflush( file ) != 0 || fsync( fileno( file ) ) != 0
+      || fclose( file ) != 0 || rename( temp, gCheckpointPath ) != 0 )
+    {
+        fprintf( stderr, "### Error: Unable to write checkpoint \'%s\' (%d: %s)\n",
+                 gCheckpointPath, errno, strerror(errno) );
+        remove( temp );
+        return errno;
+    }
+
+    gCheckpointWritten = time( NULL );
+    gSinceWritten = 0;
+    return 0;
+}
+
+/**
+ * @brief start recording progress in 'path', resuming from it if it already exists
+ */
+int checkpointOpen( string path )
+{
+    gCheckpointPath = strdup( path );
+    memset( &gCheckpoint, 0, sizeof(gCheckpoint) );
+    memset( &gResumeFrom, 0, sizeof(gResumeFrom) );
+    gCheckpoint.inputDigest  = 0xcbf29ce484222325ULL;
+    gCheckpoint.outputDigest = 0xcbf29ce484222325ULL;
+
+    FILE * file = fopen( path, "r" );
+    if ( file == NULL )
+    {
+        return ( errno == ENOENT ) ? 0 : errno;
+    }
+
+    unsigned long long inputDigest, outputDigest;
+    int count = fscanf( file, "inputs %llu offset %llu input-digest %llx output-digest %llx",
+                        &gResumeFrom.inputs, &gResumeFrom.offset, &inputDigest, &outputDigest );
+    fclose( file );
+
+    if ( count != 4 )
+    {
+        fprintf( stderr, "### Error: checkpoint \'%s\' is damaged, remove it to start over\n", path );
+        return -1;
+    }
+    gResumeFrom.inputDigest  = inputDigest;
+    gResumeFrom.outputDigest = outputDigest;
+
+    debugf( 1, "resuming after %llu inputs\n", gResumeFrom.inputs );
+    return 0;
+}
+
+/**
+ * @brief while resuming, account for an input that was completed by an earlier run
+ * @return 1 if the input should be skipped, 0 if it should be processed, or -1 if
+ *         the input doesn't match what the checkpoint recorded
+ */
+int checkpointSkip( string input )
+{
+    if ( gCheckpointPath == NULL || gCheckpoint.inputs >= gResumeFrom.inputs )
+    {
+        return 0;
+    }
+
+    gCheckpoint.inputDigest = digest( gCheckpoint.inputDigest, input );
+    ++gCheckpoint.inputs;
+
+    if ( gCheckpoint.inputs == gResumeFrom.inputs )
+    {
+        if ( gCheckpoint.inputDigest != gResumeFrom.inputDigest )
+        {
+            fprintf( stderr, "### Error: the input doesn't match checkpoint \'%s\'\n", gCheckpointPath );
+            return -1;
+        }
+        // carry on from where the earlier run left off
+        gCheckpoint.offset       = gResumeFrom.offset;
+        gCheckpoint.outputDigest = gResumeFrom.outputDigest;
+        debugf( 1, "skipped %llu completed inputs\n", gCheckpoint.inputs );
+    }
+    return 1;
+}
+
+void checkpointOutput( string output )
+{
+    if ( gCheckpointPath != NULL )
+    {
+        gCheckpoint.outputDigest = digest( gCheckpoint.outputDigest, output );
+    }
+}
+
+/**
+ * @brief record that an input has been completed
+ * @param offset how far into stdin we've read, including this input
+ */
+void checkpointInput( string input, unsigned long long offset )
+{
+    if ( gCheckpointPath == NULL )
+    {
+        return;
+    }
+
+    gCheckpoint.inputDigest = digest( gCheckpoint.inputDigest, input );
+    gCheckpoint.offset      = offset;
+    ++gCheckpoint.inputs;
+
+    if ( ++gSinceWritten >= kCheckpointEvery || time( NULL ) - gCheckpointWritten >= kCheckpointInterval )
+    {
+        writeCheckpoint();
+    }
+}
+
+/**
+ * @brief the run is over. If it got past the checkpoint, it's no longer needed
+ */
+int checkpointClose( void )
+{
+    int result = 0;
+
+    if ( gCheckpointPath == NULL )
+    {
+        return 0;
+    }
+
+    if ( gCheckpoint.inputs < gResumeFrom.inputs )
+    {
+        fprintf( stderr, "### Error: the input ended before checkpoint \'%s\' did\n", gCheckpointPath );
+        result = -1;
+    }
+    else
+    {
+        debugf( 1, "completed %llu inputs, output digest %016llx\n",
+                gCheckpoint.inputs, (unsigned long long)gCheckpoint.outputDigest );
+        remove( gCheckpointPath );
+    }
+
+    free( (void *)gCheckpointPath );
+    gCheckpointPath = NULL;
+    return result;
+}
@@ -0,0 +1,14 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_CHECKPOINT_H
+#define DVR2PLEX_CHECKPOINT_H
+
+int  checkpointOpen( string path );
+int  checkpointSkip( string input );
+void checkpointOutput( string output );
+void checkpointInput( string input, unsigned long long offset );
+int  checkpointClose( void );
+
+#endif // DVR2PLEX_CHECKPOINT_H
@@ -0,0 +1,327 @@
+//
+// Created by paul on 10/19/26.
+//
+// Config files that have been parsed are saved in a compact binary form in
+// a cache directory, so that the next time the same config file is visited
+// (either later in this run, or in a later run) it can be mapped into memory
+// and added to a dictionary without any text parsing or hashing at all.
+//
+// The cache file layout is a header, followed by an array of entries (one
+// per parameter, in the order they appeared in the config file), followed
+// by a string pool holding the path of the original config file and all the
+// values. The header records the inode, size and modification time of the
+// original config file, so a stale cache file is simply ignored, and will
+// be replaced after the config file has been parsed again.
+//
+#define _XOPEN_SOURCE 700
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dictionary.h"
+#include "configcache.h"
+
+#define kConfigCacheMagic   0x43503244  // 'D2PC'
+#define kConfigCacheVersion 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t  mtimeSec;
+    int64_t  mtimeNsec;
+    uint32_t count;      // number of tConfigCacheEntry that follow
+    uint32_t poolSize;   // size of the string pool that follows the entries
+} tConfigCacheHeader;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t offset;     // offset of the value in the string pool
+    uint32_t reserved;
+} tConfigCacheEntry;
+
+/* cache files we have already mapped, so revisiting a config file is cheap */
+typedef struct sConfigCacheMapping {
+    struct sConfigCacheMapping * next;
+    const tConfigCacheHeader   * header;
+    size_t                       length;
+    string                       path;
+} tConfigCacheMapping;
+
+static tConfigCacheMapping * gMappings = NULL;
+static tConfigCacheMapping * gRetired  = NULL;  // stale, but may still be referenced
+
+static int isFresh( const tConfigCacheHeader * header, const struct stat * fileStat )
+{
+    return header->magic     == kConfigCacheMagic
+        && header->version   == kConfigCacheVersion
+        && header->device    == (uint64_t)fileStat->st_dev
+        && header->inode     == (uint64_t)fileStat->st_ino
+        && header->size      == (uint64_t)fileStat->st_size
+        && header->mtimeSec  == (int64_t)fileStat->st_mtim.tv_sec
+        && header->mtimeNsec == (int64_t)fileStat->st_mtim.tv_nsec;
+}
+
+/**
+ * @brief generate the name of the cache file for a given config file path
+ */
+static void cacheFileName( char * buffer, size_t size, string cacheDir, string path )
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for ( const unsigned char * p = (const unsigned char *)path; *p != '\0'; p++ )
+    {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+    snprintf( buffer, size, "%s/%016llx.conf.cache", cacheDir, (unsigned long long)hash );
+}
+
+static void unmapConfigCache( tConfigCacheMapping * mapping )
+{
+    munmap( (void *)mapping->header, mapping->length );
+    free( (void *)mapping->path );
+    free( mapping );
+}
+
+static void addFromConfigCache( tDictionary * dictionary, const tConfigCacheHeader * header )
+{
+    const tConfigCacheEntry * entry = (const tConfigCacheEntry *)(header + 1);
+    const char * pool = (const char *)(entry + header->count);
+
+    for ( uint32_t i = 0; i < header->count; ++i )
+    {
+        addParamRef( dictionary, entry[i].hash, pool + entry[i].offset );
+    }
+}
+
+/**
+ * @brief  try to populate the dictionary from the cached form of a config file
+ * @return 0 if the cache was fresh and used, otherwise non-zero (and the caller
+ *         should parse the config file itself)
+ */
+int loadConfigCache( tDictionary * dictionary, string cacheDir, string path, const struct stat * fileStat )
+{
+    tConfigCacheMapping ** prev = &gMappings;
+    tConfigCacheMapping  * mapping;
+
+    // have we already mapped it?
+    for ( mapping = gMappings; mapping != NULL; mapping = mapping->next )
+    {
+        if ( strcmp( mapping->path, path ) == 0 )
+        {
+            break;
+        }
+        prev = &mapping->next;
+    }
+
+    if ( mapping != NULL && !isFresh( mapping->header, fileStat ) )
+    {
+        // the config file changed underneath us. Note that existing dictionary
+        // entries may still refer to the old mapping, so we must not unmap it yet.
+        *prev = mapping->next;
+        mapping->next = gRetired;
+        gRetired = mapping;
+        mapping = NULL;
+    }
+
+    if ( mapping == NULL )
+    {
+        char  cacheFile[PATH_MAX];
+        int   fd;
+        struct stat cacheStat;
+
+        cacheFileName( cacheFile, sizeof(cacheFile), cacheDir, path );
+
+        fd = open( cacheFile, O_RDONLY | O_CLOEXEC );
+        if ( fd < 0 )
+        {
+            return -1;
+        }
+
+        void * base = MAP_FAILED;
+        if ( fstat( fd, &cacheStat ) == 0 && (size_t)cacheStat.st_size >= sizeof(tConfigCacheHeader) )
+        {
+            base = mmap( NULL, cacheStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        }
+        close( fd );
+
+        if ( base == MAP_FAILED )
+        {
+            return -1;
+        }
+
+        const tConfigCacheHeader * header = base;
+        size_t length = (size_t)cacheStat.st_size - sizeof(tConfigCacheHeader);
+        int    valid  = isFresh( header, fileStat )
+                     && header->count <= length / sizeof(tConfigCacheEntry)
+                     && header->poolSize == length - header->count * sizeof(tConfigCacheEntry)
+                     && header->poolSize > 0;
+
+        const tConfigCacheEntry * entry = (const tConfigCacheEntry *)(header + 1);
+        const char * pool = valid ? (const char *)(entry + header->count) : NULL;
+
+        valid = valid && pool[ header->poolSize - 1 ] == '\0' && strcmp( pool, path ) == 0;
+        for ( uint32_t i = 0; valid && i < header->count; ++i )
+        {
+            valid = entry[i].offset < header->poolSize;
+        }
+
+        if ( !valid )
+        {
+            debugf( 3, "stale config cache: \'%s\'\n", cacheFile );
+            munmap( base, cacheStat.st_size );
+            return -1;
+        }
+
+        mapping = calloc( 1, sizeof(tConfigCacheMapping) );
+        if ( mapping == NULL )
+        {
+            munmap( base, cacheStat.st_size );
+            return -1;
+        }
+        mapping->header = header;
+        mapping->length = cacheStat.st_size;
+        mapping->path   = strdup( path );
+        mapping->next   = gMappings;
+        gMappings = mapping;
+
+        debugf( 3, "mapped config cache: \'%s\'\n", cacheFile );
+    }
+
+    addFromConfigCache( dictionary, mapping->header );
+
+    return 0;
+}
+
+/**
+ * @brief save the parameters parsed from a config file in the cache directory.
+ *
+ * The parameters are those from 'first' up to (but not including) 'last', i.e.
+ * those pushed on the front of the dictionary while parsing. So they are in the
+ * reverse of the order they appeared in the config file.
+ */
+int saveConfigCache( string cacheDir, string path, const struct stat * fileStat, tParam * first, tParam * last )
+{
+    int      result = 0;
+    uint32_t count  = 0;
+    size_t   poolSize = strlen( path ) + 1;
+    tParam * p;
+
+    for ( p = first; p != last && p != NULL; p = p->next )
+    {
+        ++count;
+        poolSize += strlen( p->value ) + 1;
+    }
+
+    size_t length = sizeof(tConfigCacheHeader) + count * sizeof(tConfigCacheEntry) + poolSize;
+    char * buffer = calloc( 1, length );
+    if ( buffer == NULL )
+    {
+        return -ENOMEM;
+    }
+
+    tConfigCacheHeader * header = (tConfigCacheHeader *)buffer;
+    tConfigCacheEntry  * entry  = (tConfigCacheEntry *)(header + 1);
+    char * pool = (char *)(entry + count);
+
+    header->magic     = kConfigCacheMagic;
+    header->version   = kConfigCacheVersion;
+    header->device    = fileStat->st_dev;
+    header->inode     = fileStat->st_ino;
+    header->size      = fileStat->st_size;
+    header->mtimeSec  = fileStat->st_mtim.tv_sec;
+    header->mtimeNsec = fileStat->st_mtim.tv_nsec;
+    header->count     = count;
+    header->poolSize  = poolSize;
+
+    char * s = stpcpy( pool, path ) + 1;
+
+    // the list is in reverse order, so fill the entries from the end
+    uint32_t i = count;
+    for ( p = first; p != last && p != NULL; p = p->next )
+    {
+        --i;
+        entry[i].hash   = p->hash;
+        entry[i].offset = s - pool;
+        s = stpcpy( s, p->value ) + 1;
+    }
+
+    char cacheFile[PATH_MAX];
+    char tempFile[PATH_MAX + 16];
+
+    mkdir( cacheDir, 0755 );   // in case it doesn't exist yet
+    cacheFileName( cacheFile, sizeof(cacheFile), cacheDir, path );
+    snprintf( tempFile, sizeof(tempFile), "%s.%d", cacheFile, getpid() );
+
+    int fd = open( tempFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+    if ( fd < 0 )
+    {
+        fprintf( stderr, "### Error: Unable to create config cache \'%s\' (%d: %s)\n",
+                 tempFile, errno, strerror(errno) );
+        result = errno;
+    }
+    else
+    {
+        if ( write( fd, buffer, length ) != (ssize_t)length )
+        {
+            result = errno;
+        }
+        if ( close( fd ) != 0 && result == 0 )
+        {
+            result = errno;
+        }
+
+        // rename is atomic, so other instances never see a partial file
+        if ( result == 0 && rename( tempFile, cacheFile ) != 0 )
+        {
+            result = errno;
+        }
+
+        if ( result != 0 )
+        {
+            fprintf( stderr, "### Error: Unable to write config cache \'%s\' (%d: %s)\n",
+                     cacheFile, result, strerror(result) );
+            unlink( tempFile );
+        }
+        else
+        {
+            debugf( 3, "saved config cache: \'%s\'\n", cacheFile );
+        }
+    }
+
+    free( buffer );
+    return result;
+}
+
+/**
+ * @brief unmap all the cache files. Only call this once the dictionaries that
+ * may refer to them have been emptied.
+ */
+static void unmapList( tConfigCacheMapping * mapping )
+{
+    while ( mapping != NULL )
+    {
+        tConfigCacheMapping * next = mapping->next;
+        unmapConfigCache( mapping );
+        mapping = next;
+    }
+}
+
+void releaseConfigCache( void )
+{
+    unmapList( gMappings );
+    gMappings = NULL;
+    unmapList( gRetired );
+    gRetired = NULL;
+}
@@ -0,0 +1,14 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_CONFIGCACHE_H
+#define DVR2PLEX_CONFIGCACHE_H
+
+#include <sys/stat.h>
+
+int  loadConfigCache( tDictionary * dictionary, string cacheDir, string path, const struct stat * fileStat );
+int  saveConfigCache( string cacheDir, string path, const struct stat * fileStat, tParam * first, tParam * last );
+void releaseConfigCache( void );
+
+#endif // DVR2PLEX_CONFIGCACHE_H
@@ -8,10 +8,32 @@
 
 #include "dictionary.h"
 
+/*
+   Keywords may be given a fixed slot each, so a dictionary can also keep
+   the most recent param for each keyword in an array, and finding one is a
+   single load rather than a walk of the list. Other hashes are still found
+   by walking the list. Must be set before any dictionaries are created.
+ */
+static unsigned int  gSlotCount = 0;
+static tSlotFunction gSlotOf    = NULL;
+
+void setDictionarySlots( unsigned int count, tSlotFunction slotOf )
+{
+    gSlotCount = count;
+    gSlotOf    = slotOf;
+}
+
 tDictionary * createDictionary( const char * name )
 {
     tDictionary * result = (tDictionary *)calloc( 1, sizeof(tDictionary) );
-    result->name = name;
+    if ( result != NULL )
+    {
+        result->name = name;
+        if ( gSlotCount > 0 )
+        {
+            result->slot = calloc( gSlotCount, sizeof(tParam *) );
+        }
+    }
     return result;
 }
 
@@ -19,10 +41,15 @@ void emptyDictionary( tDictionary * dictionary )
 {
 	tParam * p = dictionary->head;
 	dictionary->head = NULL;
+	++dictionary->changes;
+	if ( dictionary->slot != NULL )
+	{
+		memset( dictionary->slot, 0, gSlotCount * sizeof(tParam *) );
+	}
 
 	while ( p != NULL)
 	{
-		if ( p->value != NULL )
+		if ( p->owned && p->value != NULL )
 		{
 			free( (void *) p->value );
 		}
@@ -36,6 +63,7 @@ void emptyDictionary( tDictionary * dictionary )
 void destroyDictionary( tDictionary * dictionary )
 {
     emptyDictionary( dictionary );
+    free( dictionary->slot );
     free( dictionary );
 }
 
@@ -54,7 +82,7 @@ void printDictionary( tDictionary * dictionary )
     }
 }
 
-int addParam( tDictionary * dictionary, tHash hash, const char * value )
+static int _addParam( tDictionary * dictionary, tHash hash, const char * value, int copy )
 {
     int result = -1;
 
@@ -63,21 +91,60 @@ int addParam( tDictionary * dictionary, tHash hash, const char * value )
     if (p != NULL)
     {
         p->hash  = hash;
-        p->value = strdup( value );
+        p->value = copy ? strdup( value ) : value;
+        p->owned = copy;
 
         p->next = dictionary->head;
         dictionary->head = p;
+        ++dictionary->changes;
+
+        if ( dictionary->slot != NULL )
+        {
+            int slot = gSlotOf( hash );
+            if ( slot >= 0 )
+            {
+                dictionary->slot[ slot ] = p;
+            }
+        }
 
         result = 0;
     }
     return result;
 }
 
+/**
+ * @brief add a parameter to the dictionary, with its own copy of the value
+ */
+int addParam( tDictionary * dictionary, tHash hash, const char * value )
+{
+    return _addParam( dictionary, hash, value, 1 );
+}
+
+/**
+ * @brief add a parameter to the dictionary that refers to the value in place.
+ * The caller must ensure the value outlives the dictionary entry, i.e. it must
+ * not be freed or modified until after the dictionary is next emptied.
+ */
+int addParamRef( tDictionary * dictionary, tHash hash, const char * value )
+{
+    return _addParam( dictionary, hash, value, 0 );
+}
+
 string findValue( tDictionary * dictionary, tHash hash )
 {
     string result = NULL;
     tParam * p = dictionary->head;
 
+    if ( dictionary->slot != NULL )
+    {
+        int slot = gSlotOf( hash );
+        if ( slot >= 0 )
+        {
+            p = dictionary->slot[ slot ];
+            return ( p != NULL ) ? p->value : NULL;
+        }
+    }
+
     while (p != NULL)
     {
         if ( p->hash == hash )
@@ -11,19 +11,27 @@ typedef struct tParam {
     struct tParam * next;
     const char    * value;
     tHash           hash;
+    int             owned;  // value is our own copy, and must be freed
 } tParam;
 
 typedef struct {
-    tParam     * head;
-    const char * name;
+    tParam      * head;
+    const char  * name;
+    tParam     ** slot;      // most recent param for each keyword slot, if slots are in use
+    unsigned int  changes;   // incremented whenever the dictionary is modified
 } tDictionary;
 
+/* returns the slot for a keyword hash, or -1 if it's not a keyword */
+typedef int (* tSlotFunction)( tHash hash );
+
+         void  setDictionarySlots( unsigned int count, tSlotFunction slotOf );
 tDictionary *  createDictionary( const char * name );
          void  emptyDictionary( tDictionary * dictionary );
          void  destroyDictionary( tDictionary * dictionary );
        string  lookupHash( tHash );
          void  printDictionary( tDictionary * dictionary);
           int  addParam( tDictionary * dictionary, tHash hash, string value );
+          int  addParamRef( tDictionary * dictionary, tHash hash, string value );
        string  findValue( tDictionary * dictionary, tHash hash );
 
 #endif // DVR2PLEX_DICTIONARY_H
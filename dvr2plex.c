@@ -2,6 +2,7 @@
    Copyright &copy; Paul Chambers, 2019.
 
    @ToDo Switch to UTF-8 string handling, rather than relying on ASCII backwards-compatibility
+         (for now, non-ASCII names are folded into ASCII before hashing, see utf8.c)
 */
 
 #define _XOPEN_SOURCE 700
@@ -12,8 +13,10 @@
 #include <stdio.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 #include <time.h>
 #include <libgen.h> // for basename()
@@ -25,8 +28,25 @@
 #include <sys/stat.h>
 
 #include <dlfcn.h>
+#include <pthread.h>
+#include <poll.h>
 
 #include "dictionary.h"
+#include "configcache.h"
+#include "pattern.h"
+#include "utf8.h"
+#include "trace.h"
+#include "metrics.h"
+#include "episodeindex.h"
+#include "inodeindex.h"
+#include "fingerprint.h"
+#include "notify.h"
+#include "checkpoint.h"
+#include "walk.h"
+#include "snapshot.h"
+#include "recordings.h"
+#include "typoindex.h"
+#include "guide.h"
 
 
 /*  hashes for patterns we are scanning for in the filename
@@ -70,21 +90,205 @@ unsigned int gNextYear = 1895;
 tDictionary * gMainDict;
 tDictionary * gPathDict;
 tDictionary * gFileDict;
-tDictionary * gSeriesDict;
+tDictionary * gSeriesDict;      // the series index in use, either gScannedSeries or a snapshot's
+tDictionary * gScannedSeries;
 
-string gCachedPath   = NULL;
-string gCachedSeries = NULL;
+string gCachedDirectory = NULL;
+string gCachedPath      = NULL;
+string gCachedSeries    = NULL;
+
+/*
+   {destination} may be a colon-separated list of roots, e.g. one per disk.
+   Each root has its own segment of the series index, holding the series
+   folders found in it. A segment is only rescanned if its root directory
+   has changed, so a change on one disk doesn't mean rescanning all of them.
+   The segments of the current roots are merged into gSeriesDict, with the
+   earlier roots taking precedence.
+ */
+#define kMaxRoots 16
+
+typedef struct sSeriesSegment {
+	struct sSeriesSegment * next;
+	string          root;
+	struct timespec mtime;      // of the root directory when it was scanned
+	tDictionary   * series;     // series folder names in this root
+	char         ** names;      // each is the folder name, a NUL, then the root
+	unsigned int    count;
+	int             scanned;
+	unsigned int    typos;      // how many typos to tolerate, set before scanning
+	tTypoIndex    * typoIndex;  // the folder names, if typos is non-zero
+} tSeriesSegment;
+
+tSeriesSegment * gSegments = NULL;            // every root seen so far
+tSeriesSegment * gActive[ kMaxRoots ];        // the roots of the current destination, in order
+unsigned int     gActiveCount = 0;
+
+/*
+   When reading from stdin, the main dictionary and the series index of its
+   destination are held in an immutable snapshot, which is rebuilt in the
+   background if a config file or a destination root changes, see snapshot.c.
+   The globals are switched over to the latest snapshot between files.
+ */
+#define kConfigFiles 3      // /etc, ~/.config and -c
+
+typedef struct {
+	tDictionary    * main;
+	tDictionary    * series;
+	tSeriesSegment * segment[ kMaxRoots ];      // owned by the snapshot, not in gSegments
+	unsigned int     segmentCount;
+	string           destination;
+	struct timespec  mtime[ kConfigFiles ];     // of each of gConfigFiles, zero if it's missing
+} tConfigSnapshot;
+
+tConfigSnapshot * gSnapshot    = NULL;         // the snapshot the globals currently refer to
+tDictionary     * gCommandDict = NULL;         // the parameters set on the command line
+
+/* how many times the config hierarchy had to be walked, and for how many files */
+unsigned int gConfigResolutions = 0;
+unsigned int gFileCount         = 0;
+
+/*
+   Per-stage timing, only collected by --golden (see checkGolden), so the
+   usual path pays for a test of gTimingStages and nothing more.
+ */
+typedef enum {
+	kStageConfig,       // processConfigPath()
+	kStageTokenize,     // tokenizeName(), including merging dates
+	kStageStore,        // storeToken(), including storeSeries()
+	kStageBuild,        // buildString()
+	kStageCount
+} tStage;
+
+static const string kStageNames[ kStageCount ] = { "config", "tokenize", "store", "build" };
+
+int      gTimingStages = 0;
+uint64_t gStageNanos[ kStageCount ];
+
+static inline uint64_t stageStart( void )
+{
+	struct timespec now;
+
+	if ( !gTimingStages )
+	{
+		return 0;
+	}
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static inline void stageStop( tStage stage, uint64_t start )
+{
+	if ( gTimingStages )
+	{
+		gStageNanos[ stage ] += stageStart() - start;
+	}
+}
+
+/*
+   The result of resolving a source file, i.e. everything needed to act on it
+   after its dictionaries have been emptied.
+ */
+#define kMaxOutputs 8
+
+typedef struct {
+	string       built;      // the output string
+	int          execute;    // pass it to the shell, rather than printing it
+} tOutput;
+
+typedef struct {
+	tOutput      output[ kMaxOutputs ];   // one per template
+	unsigned int count;      // 0 if there's nothing to do
+	tHash        folder;     // its series folder in the episode index, or 0
+	tHash        key;        // identifies (destseries, season, episode), or 0 if not known
+	unsigned int season;
+	unsigned int episode;
+	off_t        size;
+	string       recorded;   // copy of {daterecorded}, if any
+	string       notify;     // directory to have the media server rescan, if any
+} tResolved;
+
+/*
+   Batch mode. Rather than processing each input as it arrives, collect them
+   all first, then process them grouped by their parent directory, so the
+   config hierarchy for each directory is only resolved once. The results
+   may then be output either in the original input order, or grouped.
+
+   Since every input has been resolved before any are acted upon, several
+   copies of the same episode (e.g. recorded by different DVRs) can also be
+   spotted, and only the preferred one acted upon.
+ */
+typedef enum {
+	kBatchOff = 0,
+	kBatchOriginal,
+	kBatchGrouped
+} tBatchOrder;
+
+typedef struct {
+	string       path;
+	size_t       dirLength;   // length of the parent directory part of path
+	unsigned int index;       // position in the original input
+	tResolved    resolved;
+	string       output;
+} tBatchEntry;
+
+/* how many bytes have been read from stdin, for checkpoints */
+unsigned long long gInputOffset = 0;
+
+tBatchOrder   gBatchOrder = kBatchOff;
+tBatchEntry * gBatch      = NULL;
+unsigned int  gBatchCount = 0;
+unsigned int  gBatchSize  = 0;
+
+/*
+   A small cache of recent storeSeries() results, keyed by the hash of the raw
+   series text. A batch of episodes of the same show will present the same raw
+   series text over and over, so there's no need to repeat the fuzzy matching.
+   The cache is invalidated whenever the series dictionary is rebuilt.
+ */
+#define kSeriesCacheSize    32
+
+typedef struct {
+	tHash        hash;        // hash of the raw series text
+	string       raw;         // copy of the raw series text, to rule out hash collisions
+	string       match;       // the matching {destseries}, or NULL if there wasn't one
+	size_t       split;       // offset within the raw text where the match ended
+	size_t       title;       // offset within the raw text where the title starts
+	unsigned int generation;  // the gSeriesGeneration this entry belongs to
+} tSeriesCacheEntry;
+
+tSeriesCacheEntry gSeriesCache[ kSeriesCacheSize ];
+unsigned int      gSeriesGeneration  = 0;
+unsigned int      gSeriesCacheHits   = 0;
+unsigned int      gSeriesCacheMisses = 0;
+
+/* set while parsing the names of files already in the destination */
+int gIndexingLibrary = 0;
 
 typedef struct sToken
 {
-	struct sToken * next;
 	string          start;
 	string          end;
 	tHash           hash;
 	unsigned char   seperator;
+	tPatternMatch   match;     // what the pattern captured, if anything
 } tToken;
 
-tToken gTokenList;
+/*
+   A basename can't be longer than NAME_MAX, and every token but the last
+   is followed by at least one separator, so this is as many as we can get.
+ */
+#define kMaxTokens      ( (NAME_MAX / 2) + 1 )
+
+/* the longest run of tokens that may be merged into a single date */
+#define kMaxDateTokens  4
+
+typedef struct
+{
+	tToken       token[ kMaxTokens ];       // tokens that have been classified & merged
+	unsigned int count;
+	tToken       window[ kMaxDateTokens ];  // recent tokens that may yet become a date
+	unsigned int pending;
+} tTokenList;
 
 /**
  * trim any trailing whitespace from the end of the string
@@ -137,46 +341,236 @@ string lookupHash(tHash hash)
 	return "<unknown>";
 }
 
+/*
+   Keyword slots. Each keyword in the generated KeywordHashLookup table is
+   given the slot of its position in it, so a dictionary can keep an array of
+   the keywords it holds (see dictionary.c). The main and path dictionaries
+   are flattened into gContext whenever either of them changes, so that
+   findParam() can find a keyword with a load from the file dictionary's
+   slots and, failing that, one from the context's. Anything that isn't a
+   keyword, e.g. 'template.link', goes in the context's overflow table.
+ */
+#define kSlotTableSize  256     // a power of two, comfortably more than twice the keywords
+
+typedef struct {
+	tHash hash;
+	int   slot;     // -1 if the entry is unused
+} tSlotEntry;
+
+tSlotEntry   gSlotTable[ kSlotTableSize ];
+unsigned int gSlotCount = 0;
+
+static inline unsigned int slotIndex( tHash hash, unsigned int size )
+{
+	return (unsigned int)( ( hash * 0x9E3779B97F4A7C15UL ) >> 40 ) & ( size - 1 );
+}
+
+int keywordSlot( tHash hash )
+{
+	for ( unsigned int i = slotIndex( hash, kSlotTableSize ); ; i = ( i + 1 ) & ( kSlotTableSize - 1 ) )
+	{
+		if ( gSlotTable[i].slot < 0 || gSlotTable[i].hash == hash )
+		{
+			return gSlotTable[i].slot;
+		}
+	}
+}
+
+void initKeywordSlots( void )
+{
+	for ( unsigned int i = 0; i < kSlotTableSize; ++i )
+	{
+		gSlotTable[i].slot = -1;
+	}
+
+	for ( tKeywordHashMapping * keyword = KeywordHashLookup;
+	      keyword->key != 0 && gSlotCount < kSlotTableSize / 2; ++keyword )
+	{
+		unsigned int i = slotIndex( keyword->key, kSlotTableSize );
+		while ( gSlotTable[i].slot >= 0 && gSlotTable[i].hash != keyword->key )
+		{
+			i = ( i + 1 ) & ( kSlotTableSize - 1 );
+		}
+		if ( gSlotTable[i].slot < 0 )
+		{
+			gSlotTable[i].hash = keyword->key;
+			gSlotTable[i].slot = (int)gSlotCount++;
+		}
+	}
+	setDictionarySlots( gSlotCount, keywordSlot );
+}
+
+typedef struct {
+	tHash  hash;
+	string value;   // NULL if the entry is unused
+} tOverflowEntry;
+
+typedef struct {
+	tDictionary    * main;          // what it was flattened from, and how they were at the time
+	unsigned int     mainChanges;
+	tDictionary    * path;
+	unsigned int     pathChanges;
+	string           value[ kSlotTableSize / 2 ];   // by keyword slot
+	tOverflowEntry * overflow;      // everything else, open-addressed
+	unsigned int     overflowSize;  // a power of two
+} tParamContext;
+
+tParamContext gContext;
+
+static void addToContext( tParam * param )
+{
+	int slot = keywordSlot( param->hash );
+	if ( slot >= 0 )
+	{
+		if ( gContext.value[ slot ] == NULL )
+		{
+			gContext.value[ slot ] = param->value;
+		}
+	}
+	else if ( gContext.overflow != NULL )
+	{
+		unsigned int i = slotIndex( param->hash, gContext.overflowSize );
+		while ( gContext.overflow[i].value != NULL && gContext.overflow[i].hash != param->hash )
+		{
+			i = ( i + 1 ) & ( gContext.overflowSize - 1 );
+		}
+		if ( gContext.overflow[i].value == NULL )
+		{
+			gContext.overflow[i].hash  = param->hash;
+			gContext.overflow[i].value = param->value;
+		}
+	}
+}
+
+/**
+ * @brief merge gPathDict over gMainDict into gContext. The most recent definition
+ *        in a dictionary wins, as does anything in gPathDict over gMainDict
+ */
+static void flattenContext( void )
+{
+	unsigned int others = 0;
+
+	memset( gContext.value, 0, sizeof(gContext.value) );
+	for ( tParam * p = gPathDict->head; p != NULL; p = p->next )
+	{
+		others += ( keywordSlot( p->hash ) < 0 );
+	}
+	for ( tParam * p = gMainDict->head; p != NULL; p = p->next )
+	{
+		others += ( keywordSlot( p->hash ) < 0 );
+	}
+
+	unsigned int size = 16;
+	while ( size < others * 2 )
+	{
+		size *= 2;
+	}
+	if ( size != gContext.overflowSize )
+	{
+		free( gContext.overflow );
+		gContext.overflow     = malloc( size * sizeof(tOverflowEntry) );
+		gContext.overflowSize = ( gContext.overflow != NULL ) ? size : 0;
+	}
+	if ( gContext.overflow != NULL )
+	{
+		memset( gContext.overflow, 0, gContext.overflowSize * sizeof(tOverflowEntry) );
+	}
+
+	for ( tParam * p = gPathDict->head; p != NULL; p = p->next )
+	{
+		addToContext( p );
+	}
+	for ( tParam * p = gMainDict->head; p != NULL; p = p->next )
+	{
+		addToContext( p );
+	}
+
+	gContext.main        = gMainDict;
+	gContext.mainChanges = gMainDict->changes;
+	gContext.path        = gPathDict;
+	gContext.pathChanges = gPathDict->changes;
+}
+
 /**
- * @brief look in the three dictionaries for the first occurance of a hash value
+ * @brief find the value of a hash in the file dictionary, then the path dictionary, then the main one
  * @param hash
  * @return
  */
 string findParam( tHash hash )
 {
-	string result;
+	string result = NULL;
 
-	result = findValue( gFileDict, hash );
-	if ( result == NULL )
+	if ( gContext.main != gMainDict || gContext.mainChanges != gMainDict->changes
+	  || gContext.path != gPathDict || gContext.pathChanges != gPathDict->changes )
 	{
-		result = findValue( gPathDict, hash );
+		flattenContext();
 	}
+
+	result = findValue( gFileDict, hash );   // a load from its slots, if it's a keyword
 	if ( result == NULL )
 	{
-		result = findValue( gMainDict, hash );
+		int slot = keywordSlot( hash );
+		if ( slot >= 0 )
+		{
+			result = gContext.value[ slot ];
+		}
+		else if ( gContext.overflow != NULL )
+		{
+			unsigned int i = slotIndex( hash, gContext.overflowSize );
+			while ( gContext.overflow[i].value != NULL )
+			{
+				if ( gContext.overflow[i].hash == hash )
+				{
+					return gContext.overflow[i].value;
+				}
+				i = ( i + 1 ) & ( gContext.overflowSize - 1 );
+			}
+		}
 	}
 	return result;
 }
 
+/* a folded name only adds a hash that isn't already there, so it can't shadow an exact match */
+static void addSeriesHash( tDictionary * dictionary, tHash hash, string series, int folded )
+{
+    if ( !folded || findValue( dictionary, hash ) == NULL )
+    {
+        addParamRef( dictionary, hash, series );
+    }
+}
+
 /**
    Hashes the 'series' using the 'keyword' hash table, since comparing series names needs
    slightly different logic than scanning for patterns. Separators (spaces, periods,
    underscores) are ignored completely. As are \', !, amd ?, since those are frequently
    omitted. Upper case letters are mapped to lower case since those are also very
-   inconsistent (no UTF-8 handling yet, though). and '&' is expanded to 'and' in the
-   hash, so both forms will hash to the same value.
+   inconsistent, and a name that isn't pure ASCII is folded first (accents removed,
+   full-width forms narrowed, see utf8.c), though a folded name never displaces
+   a series already added with the same hash. And '&' is expanded to 'and' in the hash,
+   so both forms will hash to the same value.
 
    Since a series name may or may not be suffixed by a year or country surrounded
    by brackets (e.g. (2019) or (US)). So a hash is added whenever a left bracket
    is encountered, so the hash for 'Some Series' and 'Some Series (2019)' are both
    stored in the series dictionary, so there will be a hash available to match
    either with or without the suffix.
+
+   @param series the folder name. The dictionary refers to it rather than copying it
  */
-void addSeries( string series )
+void addSeries( tDictionary * dictionary, string series )
 {
     tHash result = 0;
     unsigned char * s = (unsigned char *)series;
     unsigned char   c;
+    char folded[ kMaxFoldedName ];
+    int  isFolded = !isASCII( series, strlen( series ) );
+
+    // hash the folded form of any non-ASCII name, so accents etc. don't matter
+    if ( isFolded )
+    {
+        normalizeUTF8( series, folded, sizeof(folded), NULL );
+        s = (unsigned char *)folded;
+    }
 
     do {
         c = kKeywordMap[ *s++ ];
@@ -201,7 +595,7 @@ void addSeries( string series )
             // Note: if there are multiple left brackets encountered, there will be
             // multiple intermediate hashes added.
 
-            addParam( gSeriesDict, result, series );
+            addSeriesHash( dictionary, result, series, isFolded );
             result = fKeywordHashChar( result, c );
             break;
 
@@ -217,7 +611,54 @@ void addSeries( string series )
     } while ( c != '\0' );
 
     // also add the hash of the full string, including any trailing bracketed stuff
-    addParam( gSeriesDict, result, series );
+    addSeriesHash( dictionary, result, series, isFolded );
+}
+
+/**
+ * @brief the form of a series folder name used to look for typos, i.e. mapped the
+ *        same way as for its hash, but only up to any bracketed suffix
+ * @return its length, or 0 if it's too long for the typo index
+ */
+static size_t typoKey( string series, char * key )
+{
+    const unsigned char * s = (const unsigned char *)series;
+    char   folded[ kMaxFoldedName ];
+    size_t length = 0;
+
+    if ( !isASCII( series, strlen( series ) ) )
+    {
+        normalizeUTF8( series, folded, sizeof(folded), NULL );
+        s = (const unsigned char *)folded;
+    }
+
+    for ( ; *s != '\0'; s++ )
+    {
+        unsigned char c = kKeywordMap[ *s ];
+        if ( c == kKeywordLBracket )
+        {
+            break;
+        }
+        if ( c == kKeywordSeparator || c == kKeywordIgnored )
+        {
+            continue;
+        }
+        if ( length + 3 > kMaxTypoKey )
+        {
+            return 0;
+        }
+        if ( c == '&' )
+        {
+            key[ length++ ] = 'a';
+            key[ length++ ] = 'n';
+            key[ length++ ] = 'd';
+        }
+        else
+        {
+            key[ length++ ] = (char)c;
+        }
+    }
+    key[ length ] = '\0';
+    return length;
 }
 
 static int scanDirFilter( const struct dirent * entry)
@@ -230,29 +671,208 @@ static int scanDirFilter( const struct dirent * entry)
     return result;
 }
 
-int buildSeriesDictionary( string path )
+static void emptySegment( tSeriesSegment * segment )
+{
+    emptyDictionary( segment->series );
+    for ( unsigned int i = 0; i < segment->count; ++i )
+    {
+        free( segment->names[i] );
+    }
+    free( segment->names );
+    destroyTypoIndex( segment->typoIndex );
+    segment->names     = NULL;
+    segment->count     = 0;
+    segment->scanned   = 0;
+    segment->typoIndex = NULL;
+}
+
+/**
+ * @brief scan a root for series folders. May be called on several segments at once
+ */
+int buildSeriesDictionary( tSeriesSegment * segment )
 {
     struct dirent **namelist;
+    struct stat rootStat;
     int n;
 
-    n = scandir( path, &namelist, scanDirFilter, alphasort);
+    emptySegment( segment );
+
+    traceBegin( "scan", segment->root );
+    if ( stat( segment->root, &rootStat ) == 0 )
+    {
+        segment->mtime = rootStat.st_mtim;
+    }
+    n = scandir( segment->root, &namelist, scanDirFilter, alphasort);
     if ( n < 0 ) {
         perror("scandir");
+        traceEnd( "scan" );
         return n;
     }
 
+    size_t rootLength = strlen( segment->root ) + 1;
+    segment->names = calloc( n, sizeof(char *) );
+    if ( segment->typos > 0 )
+    {
+        segment->typoIndex = createTypoIndex( segment->typos );
+    }
     for ( int i = 0; i < n; ++i )
     {
-        addSeries( namelist[ i ]->d_name );
+        size_t length = strlen( namelist[ i ]->d_name ) + 1;
+        char * name   = ( segment->names != NULL ) ? malloc( length + rootLength ) : NULL;
+        if ( name != NULL )
+        {
+            memcpy( name, namelist[ i ]->d_name, length );
+            memcpy( name + length, segment->root, rootLength );
+            if ( segment->typoIndex != NULL )
+            {
+                char key[ kMaxTypoKey + 1 ];
+                if ( typoKey( name, key ) > 0 )
+                {
+                    addTypoKey( segment->typoIndex, key, segment->count );
+                }
+            }
+            segment->names[ segment->count++ ] = name;
+            addSeries( segment->series, name );
+        }
         free( namelist[ i ] );
     }
     free(namelist);
+    segment->scanned = 1;
+    traceEnd( "scan" );
 
-    /* printDictionary( dictionary ); */
+    /* printDictionary( segment->series ); */
 
     return 0;
 }
 
+static void * scanSegmentThread( void * segment )
+{
+    buildSeriesDictionary( segment );
+    return NULL;
+}
+
+/**
+ * @brief merge the segments into 'series', so the earlier roots end up at its head
+ */
+static void mergeSeriesSegments( tDictionary * series, tSeriesSegment ** segments, unsigned int count )
+{
+    emptyDictionary( series );
+    for ( unsigned int i = count; i-- > 0; )
+    {
+        unsigned int length = 0;
+        for ( tParam * p = segments[i]->series->head; p != NULL; p = p->next )
+        {
+            ++length;
+        }
+
+        tParam ** params = ( length > 0 ) ? malloc( length * sizeof(tParam *) ) : NULL;
+        if ( params == NULL )
+        {
+            continue;
+        }
+        length = 0;
+        for ( tParam * p = segments[i]->series->head; p != NULL; p = p->next )
+        {
+            params[ length++ ] = p;
+        }
+        // preserving the order within the segment
+        while ( length-- > 0 )
+        {
+            addParamRef( series, params[ length ]->hash, params[ length ]->value );
+        }
+        free( params );
+    }
+}
+
+/**
+ * @brief make the roots in 'destination' the current ones, scanning any that have
+ *        changed (concurrently), and merge their segments into gScannedSeries
+ */
+void selectSeriesSegments( string destination )
+{
+    tSeriesSegment * scan[ kMaxRoots ];
+    pthread_t        thread[ kMaxRoots ];
+    unsigned int     scanCount = 0;
+    char           * roots = strdup( destination );
+    char           * next  = NULL;
+    string           typos = findParam( kKeywordTypos );
+    unsigned int     tolerance = ( typos != NULL ) ? (unsigned int)atoi( typos ) : 0;
+
+    gActiveCount = 0;
+    for ( char * root = strtok_r( roots, ":", &next ); root != NULL && gActiveCount < kMaxRoots;
+          root = strtok_r( NULL, ":", &next ) )
+    {
+        tSeriesSegment * segment;
+
+        for ( segment = gSegments; segment != NULL; segment = segment->next )
+        {
+            if ( strcmp( segment->root, root ) == 0 )
+            {
+                break;
+            }
+        }
+        if ( segment == NULL )
+        {
+            segment = calloc( 1, sizeof(tSeriesSegment) );
+            if ( segment == NULL )
+            {
+                continue;
+            }
+            segment->root   = strdup( root );
+            segment->series = createDictionary( "Series" );
+            segment->next   = gSegments;
+            gSegments = segment;
+        }
+
+        struct stat rootStat;
+        if ( !segment->scanned || segment->typos != tolerance || stat( root, &rootStat ) != 0
+          || rootStat.st_mtim.tv_sec  != segment->mtime.tv_sec
+          || rootStat.st_mtim.tv_nsec != segment->mtime.tv_nsec )
+        {
+            debugf( 2, "scanning '%s'\n", root );
+            segment->typos = tolerance;
+            scan[ scanCount++ ] = segment;
+        }
+        gActive[ gActiveCount++ ] = segment;
+    }
+    free( roots );
+
+    // scan the roots that need it in parallel, as they're most likely on different disks
+    unsigned int started = 0;
+    if ( scanCount > 1 )
+    {
+        while ( started < scanCount && pthread_create( &thread[ started ], NULL, scanSegmentThread, scan[ started ] ) == 0 )
+        {
+            ++started;
+        }
+    }
+    for ( unsigned int i = started; i < scanCount; ++i )
+    {
+        buildSeriesDictionary( scan[i] );
+    }
+    for ( unsigned int i = 0; i < started; ++i )
+    {
+        pthread_join( thread[i], NULL );
+    }
+
+    mergeSeriesSegments( gScannedSeries, gActive, gActiveCount );
+    gSeriesDict = gScannedSeries;
+}
+
+void releaseSeriesSegments( void )
+{
+    while ( gSegments != NULL )
+    {
+        tSeriesSegment * next = gSegments->next;
+        emptySegment( gSegments );
+        destroyDictionary( gSegments->series );
+        free( (void *)gSegments->root );
+        free( gSegments );
+        gSegments = next;
+    }
+    gActiveCount = 0;
+}
+
 void addSeasonEpisode( unsigned int season, unsigned int episode )
 {
     char  temp[50];
@@ -261,7 +881,7 @@ void addSeasonEpisode( unsigned int season, unsigned int episode )
     addParam( gFileDict, kKeywordSeason, temp );
     if ( season == 0 || episode == 0 )
     {
-	    addParam( gFileDict, kKeywordSeasonFolder, "Specials" );
+	    addParamRef( gFileDict, kKeywordSeasonFolder, "Specials" );
     }
     else
     {
@@ -273,73 +893,240 @@ void addSeasonEpisode( unsigned int season, unsigned int episode )
     addParam( gFileDict, kKeywordEpisode, temp );
 }
 
-void storeSeries( string series )
+/**
+ * @brief if no run of words at the start of 'text' is exactly the name of a series
+ *        folder, look for one that's only a typo or two away from one, preferring
+ *        the longest run. Only folder names long enough that a typo is unlikely to
+ *        make them into a different name are considered: at least 6 characters
+ *        for one typo, 10 for two (not counting separators).
+ * @return the folder name, with 'end' set to where the run of words ends in 'text'
+ */
+#define kMaxTypoRuns 16
+
+static string findSeriesTypo( string text, string * end )
 {
-    string result = series;
-    string ptr, end;
-    tHash hash;
+    char         key[ kMaxTypoKey + 1 ];
+    size_t       length = 0;
+    size_t       runLength[ kMaxTypoRuns ];   // of the key, at the end of each run of words
+    string       runEnd[ kMaxTypoRuns ];
+    unsigned int runs = 0;
+    string       ptr  = text;
     unsigned char c;
 
-    ptr  = series;
-    hash = 0;
-
-    addParam( gFileDict, kKeywordSeries, series );
-
-    // regenerate the hash incrementally, checking at each separator.
-    // remember the longest match, i.e. keep looking until the end of the string
     do {
         c = kKeywordMap[ (unsigned char)*ptr ];
         switch ( c )
         {
         case kKeywordSeparator:
         case '\0':
-        	/* let's see if we have a match */
-            debugf( 4, "checking: 0x%016lx\n", hash );
-
-            string match = findValue( gSeriesDict, hash );
-            if ( match != NULL)
+            if ( length > 0 && runs < kMaxTypoRuns && ( runs == 0 || runLength[ runs - 1 ] != length ) )
             {
-                result = match;
-                debugf( 3, "matched %s\n", result );
-                end = ptr;
+                runLength[ runs ] = length;
+                runEnd[ runs ]    = ptr;
+                ++runs;
             }
             break;
 
+        case kKeywordIgnored:
+        case kKeywordLBracket:
+            break;
+
         case '&':
-            hash = fPatternHashChar( hash, 'a' );
-            hash = fPatternHashChar( hash, 'n' );
-            hash = fPatternHashChar( hash, 'd' );
+            if ( length + 3 <= kMaxTypoKey )
+            {
+                key[ length++ ] = 'a';
+                key[ length++ ] = 'n';
+                key[ length++ ] = 'd';
+            }
             break;
 
         default:
-            hash = fPatternHashChar( hash, c );
+            if ( length < kMaxTypoKey && c >= ' ' )   // not a right bracket
+            {
+                key[ length++ ] = (char)c;
+            }
             break;
-        };
+        }
         ptr++;
-    } while ( c != '\0' );
+    } while ( c != '\0' && length < kMaxTypoKey );
 
-    if ( result != series )
+    while ( runs-- > 0 )
     {
-        if ( *end != '\0' )
+        unsigned int limit = ( runLength[ runs ] >= 2 ) ? (unsigned int)( runLength[ runs ] - 2 ) / 4 : 0;
+        string       match = NULL;
+        int          best  = kMaxTypoDistance + 1;
+
+        for ( unsigned int i = 0; i < gActiveCount && limit > 0; ++i )
+        {
+            unsigned int id;
+            int distance = findTypoKey( gActive[i]->typoIndex, key, runLength[ runs ], limit, &id );
+
+            // the earlier root wins a tie
+            if ( distance >= 0 && distance < best )
+            {
+                best  = distance;
+                match = gActive[i]->names[ id ];
+            }
+        }
+        if ( match != NULL )
         {
-            /* if the run is longer than the match with the series name,
-               then store the trailing remnant as the episode title */
-            addParam( gFileDict, kKeywordTitle, (string) end + 1 );
-	        *(char *) end = '\0';
+            debugf( 3, "matched %s, with %d typo(s)\n", match, best );
+            *end = runEnd[ runs ];
+            return match;
         }
     }
-	addParam( gFileDict, kKeywordDestSeries, result );
+    return NULL;
 }
 
-int storeToken( tHash hash, string value )
+void storeSeries( string series )
 {
-    unsigned int season  = 0;
-    unsigned int episode = 0;
-    unsigned int year    = 0;
-    char temp[20];
-    string seriesName;
+    string result = series;
+    string ptr, end = NULL;
+    tHash hash;
+    unsigned char c;
+    tSeriesCacheEntry * cached;
+    size_t split = 0;
+    size_t title = 0;
 
-    switch (hash)
+    // first, check if we've seen exactly the same series text recently
+    hash = 0;
+    for ( ptr = series; *ptr != '\0'; ptr++ )
+    {
+        hash = fKeywordHashChar( hash, *ptr );
+    }
+    cached = &gSeriesCache[ hash % kSeriesCacheSize ];
+
+    if ( cached->generation == gSeriesGeneration && cached->hash == hash
+      && cached->raw != NULL && strcmp( cached->raw, series ) == 0 )
+    {
+        ++gSeriesCacheHits;
+        debugf( 3, "cached %s\n", cached->match != NULL ? cached->match : series );
+        if ( cached->match != NULL )
+        {
+            result = cached->match;
+            split  = cached->split;
+            title  = cached->title;
+        }
+    }
+    else
+    {
+        ++gSeriesCacheMisses;
+        free( (void *)cached->raw );
+        cached->hash       = hash;
+        cached->raw        = strdup( series );
+        cached->generation = gSeriesGeneration;
+
+        // if it's not pure ASCII, walk the folded form, keeping track of
+        // where each folded character came from in the original
+        char           folded[ kMaxFoldedName ];
+        unsigned short offsets[ kMaxFoldedName ];
+        string         text = series;
+
+        if ( !isASCII( series, strlen( series ) ) )
+        {
+            normalizeUTF8( series, folded, sizeof(folded), offsets );
+            text = folded;
+        }
+
+        ptr  = text;
+        hash = 0;
+
+        // regenerate the hash incrementally, checking at each separator.
+        // remember the longest match, i.e. keep looking until the end of the string
+        do {
+            c = kKeywordMap[ (unsigned char)*ptr ];
+            switch ( c )
+            {
+            case kKeywordSeparator:
+            case '\0':
+            	/* let's see if we have a match */
+                debugf( 4, "checking: 0x%016lx\n", hash );
+
+                string match = findValue( gSeriesDict, hash );
+                if ( match != NULL)
+                {
+                    result = match;
+                    debugf( 3, "matched %s\n", result );
+                    end = ptr;
+                }
+                break;
+
+            case '&':
+                hash = fPatternHashChar( hash, 'a' );
+                hash = fPatternHashChar( hash, 'n' );
+                hash = fPatternHashChar( hash, 'd' );
+                break;
+
+            default:
+                hash = fPatternHashChar( hash, c );
+                break;
+            };
+            ptr++;
+        } while ( c != '\0' );
+
+        if ( result == series )
+        {
+            string match = findSeriesTypo( text, &end );
+            if ( match != NULL )
+            {
+                result = match;
+            }
+        }
+
+        if ( result != series )
+        {
+            split = end - text;
+            title = split + 1;
+            if ( text != series )
+            {
+                title = ( *end != '\0' ) ? offsets[ split + 1 ] : offsets[ split ];
+                split = offsets[ split ];
+            }
+        }
+        cached->match = ( result != series ) ? result : NULL;
+        cached->split = split;
+        cached->title = title;
+    }
+
+    end = series + split;
+    if ( result != series && *end != '\0' )
+    {
+        /* if the run is longer than the match with the series name,
+           then store the trailing remnant as the episode title. The
+           series text is about to be truncated, so {series} needs its
+           own copy to remain intact */
+        addParam( gFileDict, kKeywordSeries, series );
+        addParamRef( gFileDict, kKeywordTitle, series + title );
+        *(char *) end = '\0';
+    }
+    else
+    {
+        addParamRef( gFileDict, kKeywordSeries, series );
+    }
+	addParamRef( gFileDict, kKeywordDestSeries, result );
+	if ( result != series && gActiveCount > 1 )
+	{
+		// the root the series folder is in follows its name, see buildSeriesDictionary()
+		addParamRef( gFileDict, kKeywordDestination, result + strlen( result ) + 1 );
+	}
+	if ( !gIndexingLibrary )
+	{
+		metricIncrement( result != series ? kMetricSeriesMatched : kMetricSeriesUnmatched );
+	}
+}
+
+int storeToken( const tToken * token )
+{
+    const tPatternMatch * match = &token->match;
+    // only what the pattern actually captured, otherwise zero
+    unsigned int season  = ( match->captured & (1 << kCaptureSeason) )  ? match->value[ kCaptureSeason ]  : 0;
+    unsigned int episode = ( match->captured & (1 << kCaptureEpisode) ) ? match->value[ kCaptureEpisode ] : 0;
+    unsigned int year    = ( match->captured & (1 << kCaptureYear) )    ? match->value[ kCaptureYear ]    : 0;
+    string value = token->start;
+    char temp[20];
+    string seriesName;
+
+    switch ( token->hash )
     {
     case kPatternSnnEnn:   // we found 'SnnEnn' or
     case kPatternSyyyyEnn: // SyyyyEnnn
@@ -347,21 +1134,16 @@ int storeToken( tHash hash, string value )
     case kPatternSnEnn:    // SnEnn
     case kPatternSnEn:     // SnEn
         debugf( 3,"SnnEnn: %s\n", value);
-        sscanf( value, "%*1c%u%*1c%u", &season, &episode ); // ignore characters since we don't know their case
         addSeasonEpisode( season, episode );
         break;
 
-    case kPatternEnnn:
+    case kPatternEnnn:     // the pattern splits this into season & episode
         debugf( 3,"Ennn: %s\n", value);
-        sscanf( value, "%*1c%u", &episode ); // ignore characters since we don't know their case
-        season = episode / 100;
-        episode %= 100;
         addSeasonEpisode( season, episode );
         break;
 
     case kPatternEnnnn:
         debugf( 3,"Ennnn: %s\n", value);
-        sscanf( value, "%*1c%u", &episode ); // ignore characters since we don't know their case
         unsigned int divisor = 100;
         /* see if there's a season number to extract */
         if ( ((episode / divisor) % 10) == 0 )
@@ -377,12 +1159,10 @@ int storeToken( tHash hash, string value )
     case kPatternnXnn:
     case kPatternnnXnn:
         debugf( 3, "nnXnn: %s\n", value);
-        sscanf( value, "%u%*1c%u", &season, &episode ); // ignore characters since we don't know their case
         addSeasonEpisode( season, episode );
         break;
 
     case kPatternYear:
-	    sscanf( value, "%*1c%u%*1c", &year ); // ignore characters since we don't know their case
         if ( 1890 < year && year <= gNextYear )
         {
             snprintf( temp, sizeof( temp ), "%u", year );
@@ -392,17 +1172,61 @@ int storeToken( tHash hash, string value )
 	    break;
 
     case kPatternCountryUSA:
-    	addParam( gFileDict, kKeywordCountry, "USA" );
+    	addParamRef( gFileDict, kKeywordCountry, "USA" );
     	break;
 
     case kPatternCountryUS:
-	    addParam( gFileDict, kKeywordCountry, "US" );
+	    addParamRef( gFileDict, kKeywordCountry, "US" );
 	    break;
 
     case kPatternCountryUK:
-	    addParam( gFileDict, kKeywordCountry, "UK" );
+	    addParamRef( gFileDict, kKeywordCountry, "UK" );
 	    break;
 
+    case kPatternCustom:
+        // a user-defined pattern, so use whatever it captured
+        debugf( 3, "custom: %s\n", value );
+        if ( ( match->captured & (1 << kCaptureSeason) ) && ( match->captured & (1 << kCaptureEpisode) ) )
+        {
+            addSeasonEpisode( season, episode );
+        }
+        else if ( match->captured & (1 << kCaptureEpisode) )
+        {
+            // no season to go with it, so don't make one up
+            snprintf( temp, sizeof( temp ), "%02u", episode );
+            addParam( gFileDict, kKeywordEpisode, temp );
+        }
+        else if ( match->captured & (1 << kCaptureSeason) )
+        {
+            snprintf( temp, sizeof( temp ), "%02u", season );
+            addParam( gFileDict, kKeywordSeason, temp );
+        }
+        if ( match->captured & (1 << kCaptureYear) )
+        {
+            if ( (match->captured & (1 << kCaptureMonth)) && (match->captured & (1 << kCaptureDay)) )
+            {
+                snprintf( temp, sizeof( temp ), "%04u-%02u-%02u", year,
+                          match->value[ kCaptureMonth ], match->value[ kCaptureDay ] );
+                addParam( gFileDict, kKeywordFirstAired, temp );
+            }
+            else if ( 1890 < year && year <= gNextYear )
+            {
+                snprintf( temp, sizeof( temp ), "%u", year );
+                addParam( gFileDict, kKeywordYear, temp );
+            }
+        }
+        break;
+
+    case kKeywordDateRecorded:
+        debugf( 3, "recorded: %s\n", value );
+        addParamRef( gFileDict, kKeywordDateRecorded, value );
+        break;
+
+    case kKeywordFirstAired:
+        debugf( 3, "aired: %s\n", value );
+        addParamRef( gFileDict, kKeywordFirstAired, value );
+        break;
+
     case kPatternNoMatch:
         seriesName = findParam( kKeywordSeries );
         if ( seriesName == NULL )
@@ -413,7 +1237,7 @@ int storeToken( tHash hash, string value )
         else
         {
             debugf( 3, "title: %s\n", value );
-            addParam( gFileDict, kKeywordTitle, value );
+            addParamRef( gFileDict, kKeywordTitle, value );
         }
         break;
 
@@ -427,51 +1251,256 @@ int storeToken( tHash hash, string value )
     return 0;
 }
 
-tHash checkHash( tHash hash)
-{
-    switch (hash)
-    {
-    case kPatternSnnEnn:       // SnnEnn
-    case kPatternSyyyyEnn:     // SnnnnEnn
-    case kPatternSnnEn:        // SnnEn
-    case kPatternSnEnn:        // SnEnn
-    case kPatternSnEn:         // SnEn
-    case kPatternEnnn:         // Ennn
-    case kPatternEnnnn:        // Ennnn
-    case kPatternnXnn:         // nXnn
-    case kPatternnnXnn:        // nnXnn
-    case kPatternTwoDigits:    // nn
-    case kPatternFourDigits:   // nnnn
-    case kPatternSixDigits:    // nnnnnn
-    case kPatternEightDigits:  // nnnnnnnn
-    case kPatternCountryUSA:   // (USA)
-    case kPatternCountryUS:    // (US)
-    case kPatternCountryUK:    // (UK)
-    case kPatternYear:         // (nnnn)
-    	break;
+/*
+   The patterns we recognize in a name. patterns.hash lists the same
+   layouts, but these specs are what is actually used to find them. They
+   are compiled into a DFA, along with any user-defined 'pattern's from
+   the config files. See pattern.c for the syntax.
+ */
+static const struct {
+    string spec;
+    tHash  id;
+} kBuiltinPatterns[] = {
+    { "S{season:2}E{episode:2}", kPatternSnnEnn      },
+    { "S{season:4}E{episode:2}", kPatternSyyyyEnn    },
+    { "S{season:2}E{episode:1}", kPatternSnnEn       },
+    { "S{season:1}E{episode:2}", kPatternSnEnn       },
+    { "S{season:1}E{episode:1}", kPatternSnEn        },
+    { "E{season:1}{episode:2}",  kPatternEnnn        },
+    { "E{episode:4}",            kPatternEnnnn       },
+    { "{season:1}x{episode:2}",  kPatternnXnn        },
+    { "{season:2}x{episode:2}",  kPatternnnXnn       },
+    { "00",                      kPatternTwoDigits   },
+    { "0000",                    kPatternFourDigits  },
+    { "000000",                  kPatternSixDigits   },
+    { "00000000",                kPatternEightDigits },
+    { "(USA)",                   kPatternCountryUSA  },
+    { "(US)",                    kPatternCountryUS   },
+    { "(UK)",                    kPatternCountryUK   },
+    { "({year:4})",              kPatternYear        }
+};
 
-    default:
-        hash = kPatternNoMatch;
-        break;
+/**
+ * @brief compile the built-in patterns, and any defined in the config files, into the DFA
+ */
+int buildPatterns( tDictionary * dictionary )
+{
+    int result = 0;
+
+    for ( unsigned int i = 0; i < sizeof(kBuiltinPatterns) / sizeof(kBuiltinPatterns[0]); ++i )
+    {
+        addPattern( kBuiltinPatterns[i].spec, kBuiltinPatterns[i].id );
     }
-    return hash;
+
+    for ( tParam * p = dictionary->head; p != NULL; p = p->next )
+    {
+        if ( p->hash == kKeywordPattern )
+        {
+            debugf( 3, "pattern: \'%s\'\n", p->value );
+            if ( addPattern( p->value, kPatternCustom ) != 0 )
+            {
+                result = -1;
+            }
+        }
+    }
+
+    compilePatterns();
+
+    return result;
+}
+
+/**
+ * @brief append a token to the list, merging it with the previous one if need be
+ *
+ * Runs of kPatternNoMatch tokens are combined into a single token. Some tokens
+ * are also appended to a preceding kPatternNoMatch token as a suffix, while
+ * the token itself is also retained.
+ */
+static void appendToken( tTokenList * list, const tToken * token )
+{
+	tToken * last = ( list->count > 0 ) ? &list->token[ list->count - 1 ] : NULL;
+
+	if ( last != NULL && last->hash == kPatternNoMatch )
+	{
+		switch ( token->hash )
+		{
+		case kPatternNoMatch:
+			// combine the two kPatternNoMatch tokens
+			*(char *)last->end = ' ';
+			last->end = token->end;
+			return;
+
+			/* The tokens we treat as suffixes */
+		case kPatternCountryUK:
+		case kPatternCountryUS:
+		case kPatternCountryUSA:
+		case kPatternYear:
+			/* extend the kPatternNoMatch token to include the suffix */
+			*(char *)last->end = ' ';
+			last->end = token->end;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if ( list->count < kMaxTokens )
+	{
+		list->token[ list->count++ ] = *token;
+	}
+	else
+	{
+		debugf( 1, "too many tokens, dropped \'%s\'\n", token->start );
+	}
+}
+
+/* the parts of a Channels DVR date are separated by a single '-' */
+static int isDateSeparator( const tToken * token, const tToken * next )
+{
+	return token->seperator == '-' && next->start == token->end + 1;
+}
+
+/*
+ * Channels DVR:
+ *   air date: yyyy-mm-dd
+ *   recorded: yyyy-mm-dd-hhss
+ * TVMosaic
+ *   recorded: hhss-yyyymmdd
+ *
+ * Looks at the window of recent tokens, and either merges the ones at the
+ * front into a date, or passes them on to appendToken() as they are. Stops
+ * when the window holds the beginning of what could be a date, but more
+ * tokens are needed to be sure - unless we've reached the end of the name.
+ */
+static void mergeDates( tTokenList * list, int atEnd )
+{
+	while ( list->pending > 0 )
+	{
+		tToken * token = list->window;
+		unsigned int consumed = 1;
+
+		switch ( token[0].hash )
+		{
+			// Channels DVR: YYYY-mm-dd
+			//               YYYY-mm-dd-hhss
+			//     TVMosaic: HHSS-yyyymmdd
+		case kPatternFourDigits:
+			if ( list->pending < 2 )
+			{
+				if ( !atEnd ) return;
+
+				// last token, therefore four trailing digits, no metapattern
+				token[0].hash = kPatternNoMatch;
+				break;
+			}
+
+			switch ( token[1].hash )
+			{
+				// Channels DVR: YYYY-MM-dd
+				//               YYYY-MM-dd-hhss
+			case kPatternTwoDigits:
+				if ( !isDateSeparator( &token[0], &token[1] ) )
+				{
+					break;
+				}
+				if ( list->pending < 3 )
+				{
+					if ( !atEnd ) return;
+					break;
+				}
+				if ( token[2].hash != kPatternTwoDigits || !isDateSeparator( &token[1], &token[2] ) )
+				{
+					break;
+				}
+				if ( list->pending < 4 && !atEnd )
+				{
+					return;
+				}
+
+				if ( list->pending >= 4 && token[3].hash == kPatternFourDigits && isDateSeparator( &token[2], &token[3] ) )
+				{
+					// ok, looks like we have YYYY-MM-DD-HHSS
+					*(char *) token[0].end = '-';
+					*(char *) token[1].end = '-';
+					*(char *) token[2].end = '-';
+					token[0].end  = token[3].end;
+					token[0].hash = kKeywordDateRecorded;
+					consumed = 4;
+				}
+				else
+				{
+					// ok, looks like we have YYYY-MM-DD
+					*(char *) token[0].end = '-';
+					*(char *) token[1].end = '-';
+					token[0].end  = token[2].end;
+					token[0].hash = kKeywordFirstAired;
+					consumed = 3;
+				}
+				break;
+
+				// TVMosaic: HHSS-YYYYMMDD
+			case kPatternEightDigits:
+				*(char *) token[0].end = '-';
+				token[0].end  = token[1].end;
+				token[0].hash = kKeywordDateRecorded;
+				consumed = 2;
+				break;
+
+			default:
+				token[0].hash = kPatternNoMatch;
+				break;
+			}
+			break;
+
+		default:
+			// not kPatternFourDigits, so it can't be the start of a date
+			break;
+		}
+
+		appendToken( list, &token[0] );
+
+		list->pending -= consumed;
+		memmove( &token[0], &token[ consumed ], list->pending * sizeof(tToken) );
+	}
 }
 
-void tokenizeName( string originalName )
+static int isPatternSeparator( unsigned char c )
 {
-	gTokenList.next = NULL;
+	return kPatternMap[ c ] == kPatternSeperator;
+}
 
-	string name = strdup( originalName ); // copy it, because we'll terminate strings in place as we go
+/**
+ * @brief split the name into a list of tokens, classifying and merging them as we go.
+ *
+ * Each token is produced once, and passes through a small window where date
+ * patterns are recognized, before being appended to the list (which merges
+ * runs of unrecognized tokens).
+ *
+ * @param name  note that tokens are terminated in place, so the name is modified
+ * @param list  the list to populate
+ */
+void tokenizeName( char * name, tTokenList * list )
+{
+	list->count   = 0;
+	list->pending = 0;
 
 	if ( name != NULL)
 	{
 		unsigned char c;
 
+		// multi-byte separators (e.g. a non-breaking space) are turned into
+		// spaces up front, so the loop below only has to deal with ASCII ones
+		if ( !isASCII( name, strlen( name ) ) )
+		{
+			blankSeparatorsUTF8( name, isPatternSeparator );
+		}
+
 		string start = name;
 		string ptr   = start;
-		tHash  hash  = 0;
+		tPatternState state;
 
-		tToken * token = &gTokenList;
+		resetPattern( &state );
 
 		do {
 			c = kPatternMap[ *(unsigned char *)ptr ];
@@ -480,15 +1509,18 @@ void tokenizeName( string originalName )
 			case kPatternSeperator:
 			case '\0':
 				// reached the end of a token
-				token->next = calloc( 1, sizeof(tToken) );
-				token = token->next;
-				if ( token != NULL )
 				{
-					token->hash      = checkHash( hash );
+					tToken * token = &list->window[ list->pending++ ];
+
+					token->hash      = acceptPattern( &state, &token->match ) ? token->match.id : kPatternNoMatch;
 					token->start     = start;
 					token->end       = ptr;
 					token->seperator = *ptr;
 					*(char *)ptr = '\0';
+
+					debugf( 4, "token: \'%s\', \'%s\' (%c)\n", lookupHash( token->hash ), token->start, token->seperator );
+
+					mergeDates( list, c == '\0' );
 				}
 				// only prepare for the next run if we're not at the end of the string
 				if ( c != '\0' )
@@ -496,268 +1528,294 @@ void tokenizeName( string originalName )
 					// skip over a run of kPatternSeperator, if present (e.g. ' - ')
 					do { ptr++; } while ( kPatternMap[ *(unsigned char *)ptr ] == kPatternSeperator );
 					start = ptr;
-					hash = 0;
+					resetPattern( &state );
 				}
 				break;
 
-			case '&':
-				hash = fPatternHashChar( hash, 'a' );
-				hash = fPatternHashChar( hash, 'n' );
-				hash = fPatternHashChar( hash, 'd' );
-				ptr++;
-				break;
-
             default:
-				hash = fPatternHashChar( hash, c );
-                ptr++;
+				if ( *(unsigned char *)ptr < 0x80 )
+				{
+					stepPattern( &state, *(unsigned char *)ptr );
+					ptr++;
+				}
+				else
+				{
+					// e.g. full-width digits can still be part of a pattern
+					char folded[4];
+					unsigned int length;
+					unsigned int n = foldUTF8( ptr, folded, &length );
+
+					for ( unsigned int i = 0; i < n; ++i )
+					{
+						stepPattern( &state, folded[i] );
+					}
+					ptr += length;
+				}
 				break;
 			};
 		} while ( c != '\0' );
-
-		token = gTokenList.next;
-		while ( token != NULL )
-		{
-			debugf( 4, "token: \'%s\', \'%s\' (%c)\n", lookupHash( token->hash ), token->start, token->seperator );
-			token = token->next;
-		}
 	}
 }
 
-void freeTokenList( void )
+/**
+ * @brief parse the name, and store what we find in gFileDict
+ * @param name  note that the name is modified in place
+ */
+int parseName( char * name )
 {
-    tToken *nextToken;
-    tToken * token = gTokenList.next;
-    gTokenList.next = NULL;
-    while ( token != NULL )
+    tTokenList list;
+
+    uint64_t start = stageStart();
+    tokenizeName( name, &list );
+    stageStop( kStageTokenize, start );
+
+    start = stageStart();
+
+    debugf( 4, "%s\n", "after merging" );
+    for ( unsigned int i = 0; i < list.count; ++i )
     {
-        nextToken = token->next;
-        free( token );
-        token = nextToken;
+        tToken * token = &list.token[i];
+        debugf( 4, "token: \'%s\', \'%s\' (%c)\n", lookupHash( token->hash ), token->start, token->seperator );
+
+	    storeToken( token );
     }
+    stageStop( kStageStore, start );
+
+    return 0;
 }
 
 /*
- * Channels DVR:
- *   air date: yyyy-mm-dd
- *   recorded: yyyy-mm-dd-hhss
- * TVMosaic
- *   recorded: hhss-yyyymmdd
+ * carve up the path into directory path, basename and extension, returning
+ * a copy of the basename that may be passed on to parseName() to be processed
  *
+ * To avoid copying strings for every parameter, the pieces are carved out of
+ * a single per-file buffer, which the parameters in gFileDict refer to. So the
+ * buffer must not be released until gFileDict has been emptied, see freePath().
  */
-void mergeDigits( void )
+char * gFileBuffer = NULL;
+
+static char * splitPath( string path )
 {
-    tToken * token[4];
+    addParamRef( gFileDict, kKeywordSource, path );
 
-    token[0] = gTokenList.next;
+    string lastChar  = path + strlen(path);
+    string lastSlash = strrchr( path, '/' );
+    size_t dirLength = ( lastSlash != NULL ) ? (size_t)(lastSlash - path) : 0;
+    size_t nameLength;
 
-    while ( token[0] != NULL)
+    if ( lastSlash != NULL )
     {
-        token[1] = token[0]->next;
-        switch ( token[0]->hash )
-        {
-            // Channels DVR: YYYY-mm-dd
-            //               YYYY-mm-dd-hhss
-            //     TVMosaic: HHSS-yyyymmdd
-        case kPatternFourDigits:
-            if ( token[1] != NULL)
-            {
-	            token[2] = token[1]->next;
+        ++lastSlash;
+    }
+    else
+    {
+        lastSlash = path; // no directories prefixed
+    }
 
-	            switch ( token[1]->hash )
-                {
-                    // Channels DVR: YYYY-MM-dd
-                    //               YYYY-MM-dd-hhss
-                case kPatternTwoDigits:
-                    if ( token[1]->seperator == '-' && token[2] != NULL)
-                    {
-                        switch ( token[2]->hash )
-                        {
-                            // Channels DVR: YYYY-MM-DD
-                            //               YYYY-MM-DD-hhss
-                        case kPatternTwoDigits:
-                            token[3] = token[2]->next;
-                            if (token[3] != NULL)
-                            {
-                                switch ( token[3]->hash )
-                                {
-                                case kPatternFourDigits:
-                                    // ok, looks like we have YYYY-MM-DD-HHSS
-                                    token[0]->next = token[3]->next;
-                                    *(char *) token[0]->end = '-';
-                                    *(char *) token[1]->end = '-';
-                                    *(char *) token[2]->end = '-';
-                                    token[0]->end  = token[3]->end;
-                                    token[0]->hash = kKeywordDateRecorded;
-                                    free( token[1] );
-                                    free( token[2] );
-                                    free( token[3] );
-                                    break;
-
-                                default:
-                                    // ok, looks like we have YYYY-MM-DD
-                                    token[0]->next = token[2]->next;
-                                    *(char *) token[0]->end = '-';
-                                    *(char *) token[1]->end = '-';
-                                    token[0]->end  = token[2]->end;
-                                    token[0]->hash = kKeywordFirstAired;
-                                    free( token[1] );
-                                    free( token[2] );
-                                    break;
-                                }
-                            }
-                            break;
+    // only a period in the name itself starts an extension, not one in a directory
+    string lastPeriod = strrchr( lastSlash, '.' );
+    if ( lastPeriod != NULL && (lastChar - lastPeriod) < 5 )
+    {
+        addParamRef( gFileDict, kKeywordExtension, lastPeriod );
+    }
+    else
+    {
+        lastPeriod = lastChar;
+    }
+    nameLength = lastPeriod - lastSlash;
 
-                        default:
-                            break;
-                        }
-                    }
-                    break;
+    // room for the directory, the basename, and a second copy of the basename to be tokenized
+    if ( nameLength > ( SIZE_MAX - dirLength - 3 ) / 2 )
+    {
+        fprintf( stderr, "### Error: '%s' is too long\n", path );
+        return NULL;
+    }
+    gFileBuffer = malloc( dirLength + 1 + 2 * (nameLength + 1) );
+    if ( gFileBuffer == NULL )
+    {
+        fprintf( stderr, "### Error: unable to allocate memory for \'%s\' (%d: %s)\n",
+                 path, errno, strerror(errno) );
+        return NULL;
+    }
 
-	                // TVMosaic: HHSS-YYYYMMDD
-                case kPatternEightDigits:
-	                token[0]->next = token[1]->next;
-	                *(char *) token[0]->end = '-';
-	                token[0]->end  = token[1]->end;
-	                token[0]->hash = kKeywordDateRecorded;
-	                free( token[1] );
-	                break;
+    char * dir      = gFileBuffer;
+    char * basename = dir + dirLength + 1;
+    char * name     = basename + nameLength + 1;
 
-                default:
-                    token[0]->hash = kPatternNoMatch;
-                    break;
-                }
-            }
-            else
-            {
-                // last token, therefore four trailing digits, no metapattern
-                token[0]->hash = kPatternNoMatch;
-            }
-            break;
+    if ( dirLength != 0 )
+    {
+        memcpy( dir, path, dirLength );
+        dir[ dirLength ] = '\0';
+        addParamRef( gFileDict, kKeywordPath, dir );
+    }
 
-        default:
-            // not kPatternFourDigits, ignore it.
-            break;
-        }
-        token[0] = token[0]->next;
+    memcpy( basename, lastSlash, nameLength );
+    basename[ nameLength ] = '\0';
+    addParamRef( gFileDict, kKeywordBasename, basename );
+
+    memcpy( name, basename, nameLength + 1 );
+    return name;
+}
+
+int parsePath( string path )
+{
+    char * name = splitPath( path );
+    if ( name == NULL )
+    {
+        return -ENOMEM;
     }
+    parseName( name );
+
+    return 0;
 }
 
-void mergeNoMatch( void )
+/**
+ * @brief hash a series name for the guide, the same way as for a series folder's
+ *        hash, but only up to any bracketed suffix, e.g. a year or country
+ */
+static tHash guideSeriesHash( string series )
 {
-    tToken * token;
-    tToken * nextToken;
+    const unsigned char * s = (const unsigned char *)series;
+    char  folded[ kMaxFoldedName ];
+    tHash hash = 0;
 
-	token = gTokenList.next;
-    while ( token != NULL)
+    if ( !isASCII( series, strlen( series ) ) )
     {
-        nextToken = token->next;
-        if ( nextToken != NULL && token->hash == kPatternNoMatch && nextToken->hash == kPatternNoMatch )
+        normalizeUTF8( series, folded, sizeof(folded), NULL );
+        s = (const unsigned char *)folded;
+    }
+
+    for ( ; *s != '\0' && kKeywordMap[ *s ] != kKeywordLBracket; s++ )
+    {
+        if ( *s == '&' )
         {
-            // combine the two kPatternNoMatch tokens
-            token->next = nextToken->next;
-            *(char *)token->end = ' ';
-            token->end = nextToken->end;
-            free( nextToken );
+            hash = fKeywordHashChar( hash, 'a' );
+            hash = fKeywordHashChar( hash, 'n' );
+            hash = fKeywordHashChar( hash, 'd' );
         }
-        else
+        else if ( kKeywordMap[ *s ] != kKeywordSeparator && kKeywordMap[ *s ] != kKeywordIgnored )
         {
-            token = token->next;
+            hash = fKeywordHashChar( hash, *s );
         }
     }
+    return hash;
+}
 
-	/* Some tokens should also be appended as a suffix, while also retaining the token */
-	token = gTokenList.next;
-	while ( token != NULL)
-	{
-		nextToken = token->next;
-		if ( token->hash == kPatternNoMatch && nextToken != NULL )
-		{
-			switch ( nextToken->hash )
-			{
-				/* The tokens we treat as suffixes */
-			case kPatternCountryUK:
-			case kPatternCountryUS:
-			case kPatternCountryUSA:
-			case kPatternYear:
-				/* extend the kPatternNoMatch token to include the suffix */
-				*(char *)token->end = ' ';
-				token->end = nextToken->end;
-				break;
-
-			default:
-				break;
-			}
-		}
-		token = token->next;
-	}
-}
-
-int parseName( string name )
+/**
+ * @brief a daily show usually only has the date it aired in its name, rather than
+ *        a season and episode, so look them up in the guide, if there is one
+ */
+static void lookupGuide( void )
 {
-    tToken * token = gTokenList.next;
+    string guide      = findParam( kKeywordGuide );
+    string firstAired = findParam( kKeywordFirstAired );
 
-    tokenizeName( name );
+    if ( guide == NULL || firstAired == NULL || findParam( kKeywordEpisode ) != NULL )
+    {
+        return;
+    }
+    unsigned int date = guideDate( firstAired );
+    if ( date == 0 )
+    {
+        return;
+    }
 
-    mergeDigits();
-    mergeNoMatch();
+    // the series folder's name is the most likely to match, but try the name as given too
+    string names[2] = { findParam( kKeywordDestSeries ), findParam( kKeywordSeries ) };
+    string cacheDir = findParam( kKeywordConfigCache );
 
-    debugf( 4, "%s\n", "after merging" );
-    token = gTokenList.next;
-    while ( token != NULL)
+    for ( unsigned int i = 0; i < 2; ++i )
     {
-        debugf( 4, "token: \'%s\', \'%s\' (%c)\n", lookupHash( token->hash ), token->start, token->seperator );
+        unsigned int season, episode;
+        string       title;
 
-	    storeToken( token->hash, token->start );
-	    token = token->next;
+        if ( names[i] == NULL || ( i > 0 && names[0] != NULL && strcmp( names[0], names[1] ) == 0 ) )
+        {
+            continue;
+        }
+        if ( findGuideEpisode( guide, cacheDir, guideSeriesHash, guideSeriesHash( names[i] ), date,
+                               &season, &episode, &title ) == 0 )
+        {
+            debugf( 3, "guide: %s %s is S%02uE%02u\n", names[i], firstAired, season, episode );
+            addSeasonEpisode( season, episode );
+            if ( title != NULL && findParam( kKeywordTitle ) == NULL )
+            {
+                addParam( gFileDict, kKeywordTitle, title );
+            }
+            return;
+        }
     }
-
-    freeTokenList();
-
-    return 0;
 }
 
-
-/*
- * carve up the path into directory path, basename and extension
- * then pass basename onto parseName() to be processed
+/**
+ * @brief like parsePath(), but using what Channels DVR already knows about the recording
+ *
+ * The filename is only parsed if Channels didn't say what the series and episode
+ * are, and even then, what Channels does say takes precedence. The recording's
+ * strings must remain intact until gFileDict has been emptied.
  */
-int parsePath( string path )
+int parseRecording( string path, tRecording * recording )
 {
-    int result = 0;
+    char * name = splitPath( path );
+    if ( name == NULL )
+    {
+        return -ENOMEM;
+    }
 
-    addParam( gFileDict, kKeywordSource, path );
+    if ( recording->series[0] == '\0' || recording->episode == 0 )
+    {
+        parseName( name );
+    }
 
-    string lastPeriod = strrchr( path, '.' );
-    string lastChar = path + strlen(path);
-    if ( lastPeriod != NULL && (lastChar - lastPeriod) < 5 )
+    if ( recording->recorded[0] != '\0' )
     {
-        addParam( gFileDict, kKeywordExtension, lastPeriod );
+        addParamRef( gFileDict, kKeywordDateRecorded, recording->recorded );
     }
-    else
+    if ( recording->firstAired[0] != '\0' )
     {
-        lastPeriod = lastChar;
+        addParamRef( gFileDict, kKeywordFirstAired, recording->firstAired );
     }
-
-    string lastSlash = strrchr( path, '/' );
-    if ( lastSlash != NULL )
+    if ( recording->series[0] != '\0' )
     {
-        string p = strndup( path, lastSlash - path );
-        addParam( gFileDict, kKeywordPath, p );
-        free( (void *)p );
-
-        ++lastSlash;
+        storeSeries( recording->series );   // still matched against the series folders
     }
-    else
+    if ( recording->episode != 0 )
     {
-        lastSlash = path; // no directories prefixed
+        addSeasonEpisode( recording->season, recording->episode );
+    }
+    if ( recording->title[0] != '\0' )
+    {
+        addParamRef( gFileDict, kKeywordTitle, recording->title );
     }
+    return 0;
+}
 
-    string basename = strndup( lastSlash, lastPeriod - lastSlash );
-    addParam( gFileDict, kKeywordBasename, basename );
-    parseName( basename );
-    free( (void *)basename );
+/*
+ * release the per-file buffer. Only call this once gFileDict has been emptied.
+ */
+void freePath( void )
+{
+    free( gFileBuffer );
+    gFileBuffer = NULL;
+}
 
-    return result;
+/**
+ * @brief {fingerprint} is only calculated if it's actually used, as it has to read the file
+ */
+string storeFingerprint( void )
+{
+    tFingerprint fingerprint;
+    char temp[ kFingerprintLength + 1 ];
+    string source = findParam( kKeywordSource );
+
+    if ( source == NULL || fingerprintFile( source, &fingerprint ) != 0 )
+    {
+        return NULL;
+    }
+    formatFingerprint( &fingerprint, temp );
+    addParam( gFileDict, kKeywordFingerprint, temp );
+
+    return findValue( gFileDict, kKeywordFingerprint );
 }
 
 string buildString( string template )
@@ -799,6 +1857,11 @@ string buildString( string template )
                 {
                     string value = findParam( hash );
 
+                    if ( value == NULL && hash == kKeywordFingerprint )
+                    {
+                        value = storeFingerprint();
+                    }
+
                     if ( value == NULL ) // not in the dictionaries, check for an environment variable
                     {
                         string envkey = strndup( k, t - k - 1 );
@@ -891,7 +1954,7 @@ string buildString( string template )
     return result;
 }
 
-int parseConfigFile( tDictionary * dictionary, string path )
+int parseConfigFile( tDictionary * dictionary, string path, string cacheDir )
 {
     int    result = 0;
     FILE * file;
@@ -912,6 +1975,23 @@ int parseConfigFile( tDictionary * dictionary, string path )
 	{
 	    debugf( 3, "config file: \'%s\'\n", path );
 
+	    /* if a cache directory has been defined, try to use the
+	       pre-parsed form of the config file instead */
+	    struct stat fileStat;
+	    tParam * previous = dictionary->head;
+	    if ( cacheDir != NULL && stat( path, &fileStat ) != 0 )
+	    {
+		    cacheDir = NULL;
+	    }
+	    if ( cacheDir != NULL )
+	    {
+		    if ( loadConfigCache( dictionary, cacheDir, path, &fileStat ) == 0 )
+		    {
+			    return result;
+		    }
+		    traceInstant( "config cache miss", path );
+	    }
+
 	    file = fopen(path, "r");
         if (file == NULL)
         {
@@ -953,12 +2033,39 @@ int parseConfigFile( tDictionary * dictionary, string path )
                 }
             }
             fclose(file);
+
+            if ( cacheDir != NULL )
+            {
+	            saveConfigCache( cacheDir, path, &fileStat, dictionary->head, previous );
+            }
         }
     }
 
     return result;
 }
 
+/* the config files the main dictionary is built from, NULL if not applicable */
+string gConfigFiles[ kConfigFiles ];
+
+/**
+ * @brief parse the config files found by parseConfig() into 'dictionary'
+ * @param cached use the config cache, if one has been defined by then
+ */
+int loadConfigFiles( tDictionary * dictionary, int cached )
+{
+    int result = 0;
+
+    for ( unsigned int i = 0; i < kConfigFiles && result == 0; ++i )
+    {
+        if ( gConfigFiles[i] != NULL )
+        {
+            string cacheDir = cached ? findValue( dictionary, kKeywordConfigCache ) : NULL;
+            result = parseConfigFile( dictionary, gConfigFiles[i], cacheDir );
+        }
+    }
+    return result;
+}
+
 /**
  * @brief Look for config files to process, and use them to update the main dictionary.
  *
@@ -974,26 +2081,21 @@ int parseConfig( string path )
 
     snprintf( temp, sizeof( temp ), "/etc/%s.conf", gMyName );
     debugf( 4, "/etc path: \"%s\"\n", temp );
+    gConfigFiles[0] = strdup( temp );
 
-    result = parseConfigFile( gMainDict, temp );
-
-    if ( result == 0 )
+    string home = getenv("HOME");
+    if ( home == NULL)
     {
-        string home = getenv("HOME");
-        if ( home == NULL)
-        {
-            home = getpwuid( getuid() )->pw_dir;
-        }
-        if ( home != NULL )
-        {
-            snprintf( temp, sizeof( temp ), "%s/.config/%s.conf", home, gMyName );
-            debugf( 4, "~ path: \"%s\"\n", temp );
-
-            result = parseConfigFile( gMainDict, temp );
-        }
+        home = getpwuid( getuid() )->pw_dir;
+    }
+    if ( home != NULL )
+    {
+        snprintf( temp, sizeof( temp ), "%s/.config/%s.conf", home, gMyName );
+        debugf( 4, "~ path: \"%s\"\n", temp );
+        gConfigFiles[1] = strdup( temp );
     }
 
-    if ( result == 0 && path != NULL )
+    if ( path != NULL )
     {
     	struct stat fileStat;
 
@@ -1003,7 +2105,7 @@ int parseConfig( string path )
 		    		 path, errno, strerror(errno) );
 		    result = -1;
 	    }
-	    switch ( fileStat.st_mode & S_IFMT )
+	    else switch ( fileStat.st_mode & S_IFMT )
 	    {
 	    case S_IFDIR:
 		    snprintf( temp, sizeof( temp ), "%s/%s.conf", path, gMyName );
@@ -1023,125 +2125,1810 @@ int parseConfig( string path )
     	if ( result == 0 )
 	    {
 		    debugf( 4, "-c path: %s\n", temp );
-		    result = parseConfigFile( gMainDict, temp );
+		    gConfigFiles[2] = strdup( temp );
 	    }
     }
 
-    return result;
+    if ( result == 0 )
+    {
+        result = loadConfigFiles( gMainDict, 1 );
+    }
+    return result;
+}
+
+/**
+ * @brief recurive function to walk the path looking for config files
+ * @param gFileDict
+ * @param path
+ */
+void _recurseConfig( tDictionary * dictionary, string path )
+{
+	char temp[PATH_MAX];
+
+	if ( strlen(path) != 1 || (path[0] != '/' && path[0] != '.'))
+	{
+		strncpy( temp, path, sizeof( temp ) );
+		_recurseConfig( dictionary, dirname( temp ) );
+		/* check for a config file & if found, parse it */
+		debugf( 4, "recurse = \'%s\'\n", path );
+		snprintf( temp, sizeof(temp), "%s/%s.conf", path, gMyName );
+		parseConfigFile( dictionary, temp, findParam( kKeywordConfigCache ) );
+	}
+}
+
+/**
+ * @brief point the series index globals at those in the snapshot
+ */
+static void useSnapshotSeries( tConfigSnapshot * snapshot )
+{
+	gSeriesDict  = snapshot->series;
+	gActiveCount = snapshot->segmentCount;
+	memcpy( gActive, snapshot->segment, snapshot->segmentCount * sizeof(tSeriesSegment *) );
+}
+
+/**
+   Traverse the path to the source file, looking for config files.
+   Apply them in the reverse order, so ones lower in the hierarchy
+   can override parameters defined in higher ones.
+ */
+int processConfigPath( string path )
+{
+	int  result = 0;
+	char temp[PATH_MAX];
+	string directory;
+	char * absolute;
+
+	/* dirname may modify its argument, so make a copy first */
+	strncpy( temp, path, sizeof(temp) );
+	directory = dirname( temp );
+
+	/* if the directory is spelled the same way as last time, then there's
+	 * no need to ask realpath() to resolve it again */
+	if ( gCachedDirectory == NULL || strcmp( gCachedDirectory, directory ) != 0 )
+	{
+		absolute = realpath( directory, NULL );
+		if ( absolute == NULL )
+		{
+			fprintf( stderr, "### Error: path \'%s\' appears to be invalid (%d: %s).\n",
+					 path, errno, strerror(errno) );
+			return -5;
+		}
+
+		free( (void *)gCachedDirectory );
+		gCachedDirectory = strdup( directory );
+
+		debugf( 3, "abs = %s, cached = %s\n", absolute, gCachedPath );
+		if ( gCachedPath == NULL || strcmp( gCachedPath, absolute ) != 0 )
+		{
+			debugf( 3, "absolute = \'%s\'\n", absolute );
+			emptyDictionary( gPathDict );
+			free( (void *)gCachedPath );
+			gCachedPath = absolute;
+			++gConfigResolutions;
+			_recurseConfig( gPathDict, absolute );
+		}
+		else
+		{
+			free( absolute );
+		}
+	}
+
+	/* we may have picked up a new definition of {destination} as
+	 * a result of parsing different config files. If so, we need
+	 * to rebuild gSeriesDict to reflect the new destination */
+
+	string destination = findParam( kKeywordDestination );
+
+	if ( destination == NULL)
+	{
+		fprintf( stderr, "### Error: no destination defined.\n" );
+		result = -3;
+	}
+	else
+	{
+		if ( gCachedSeries == NULL || strcmp( gCachedSeries, destination ) != 0 )
+		{
+			debugf( 2, "destination = \'%s\'\n", destination );
+			// fill the dictionary with hashes of the directory names in the destination(s)
+			++gSeriesGeneration;   // invalidates the series cache, too
+			traceInstant( "series rebuild", destination );
+			// keep our own copy, the dictionary it came from may be emptied
+			free( (void *)gCachedSeries );
+			gCachedSeries = strdup( destination );
+			if ( gSnapshot != NULL && gSnapshot->destination != NULL
+			  && strcmp( gSnapshot->destination, destination ) == 0 )
+			{
+				useSnapshotSeries( gSnapshot );
+			}
+			else
+			{
+				selectSeriesSegments( destination );
+			}
+		}
+	}
+	return result;
+}
+
+/**
+ * @brief add the parameters from 'first' up to (but not including) 'last' to
+ *        'dictionary', keeping them in the same order
+ */
+static void copyParams( tDictionary * dictionary, tParam * first, tParam * last )
+{
+	unsigned int count = 0;
+
+	for ( tParam * p = first; p != last; p = p->next )
+	{
+		++count;
+	}
+	tParam ** params = ( count > 0 ) ? malloc( count * sizeof(tParam *) ) : NULL;
+	if ( params == NULL )
+	{
+		return;
+	}
+	count = 0;
+	for ( tParam * p = first; p != last; p = p->next )
+	{
+		params[ count++ ] = p;
+	}
+	while ( count-- > 0 )
+	{
+		addParam( dictionary, params[ count ]->hash, params[ count ]->value );
+	}
+	free( params );
+}
+
+static void configFileTimes( struct timespec * mtime )
+{
+	struct stat fileStat;
+
+	for ( unsigned int i = 0; i < kConfigFiles; ++i )
+	{
+		memset( &mtime[i], 0, sizeof(struct timespec) );
+		if ( gConfigFiles[i] != NULL && stat( gConfigFiles[i], &fileStat ) == 0 )
+		{
+			mtime[i] = fileStat.st_mtim;
+		}
+	}
+}
+
+static void releaseSnapshot( void * snapshot )
+{
+	tConfigSnapshot * config = snapshot;
+
+	for ( unsigned int i = 0; i < config->segmentCount; ++i )
+	{
+		emptySegment( config->segment[i] );
+		destroyDictionary( config->segment[i]->series );
+		free( (void *)config->segment[i]->root );
+		free( config->segment[i] );
+	}
+	if ( config->series != NULL )
+	{
+		destroyDictionary( config->series );
+	}
+	destroyDictionary( config->main );
+	free( (void *)config->destination );
+	free( config );
+}
+
+/**
+ * @brief wrap 'main' in a new snapshot, along with a series index of its destination
+ *
+ * This runs on the watcher thread, so it must only use what's in the snapshot.
+ */
+static tConfigSnapshot * buildSnapshot( tDictionary * main, const struct timespec * mtime )
+{
+	tConfigSnapshot * snapshot = calloc( 1, sizeof(tConfigSnapshot) );
+	if ( snapshot == NULL )
+	{
+		return NULL;
+	}
+	snapshot->main = main;
+	memcpy( snapshot->mtime, mtime, sizeof(snapshot->mtime) );
+
+	string destination = findValue( main, kKeywordDestination );
+	if ( destination != NULL )
+	{
+		snapshot->destination = strdup( destination );
+		snapshot->series      = createDictionary( "Series" );
+
+		string typos = findValue( main, kKeywordTypos );
+
+		char * roots = strdup( destination );
+		char * next  = NULL;
+		for ( char * root = ( roots != NULL ) ? strtok_r( roots, ":", &next ) : NULL;
+		      root != NULL && snapshot->segmentCount < kMaxRoots;
+		      root = strtok_r( NULL, ":", &next ) )
+		{
+			tSeriesSegment * segment = calloc( 1, sizeof(tSeriesSegment) );
+			if ( segment != NULL )
+			{
+				segment->root   = strdup( root );
+				segment->series = createDictionary( "Series" );
+				segment->typos  = ( typos != NULL ) ? (unsigned int)atoi( typos ) : 0;
+				buildSeriesDictionary( segment );
+				snapshot->segment[ snapshot->segmentCount++ ] = segment;
+			}
+		}
+		free( roots );
+		mergeSeriesSegments( snapshot->series, snapshot->segment, snapshot->segmentCount );
+	}
+	return snapshot;
+}
+
+/**
+ * @brief on the watcher thread, rebuild the snapshot if a config file or destination root has changed
+ */
+static void * rebuildSnapshot( void * current )
+{
+	tConfigSnapshot * snapshot = current;
+	struct timespec   mtime[ kConfigFiles ];
+	struct stat       rootStat;
+	string            changed = NULL;
+
+	configFileTimes( mtime );
+	for ( unsigned int i = 0; i < kConfigFiles && changed == NULL; ++i )
+	{
+		if ( mtime[i].tv_sec != snapshot->mtime[i].tv_sec || mtime[i].tv_nsec != snapshot->mtime[i].tv_nsec )
+		{
+			changed = ( gConfigFiles[i] != NULL ) ? gConfigFiles[i] : "config";
+		}
+	}
+	for ( unsigned int i = 0; i < snapshot->segmentCount && changed == NULL; ++i )
+	{
+		tSeriesSegment * segment = snapshot->segment[i];
+		if ( stat( segment->root, &rootStat ) == 0
+		  && ( rootStat.st_mtim.tv_sec  != segment->mtime.tv_sec
+		    || rootStat.st_mtim.tv_nsec != segment->mtime.tv_nsec ) )
+		{
+			changed = segment->root;
+		}
+	}
+	if ( changed == NULL )
+	{
+		return NULL;
+	}
+	debugf( 1, "'%s' has changed, reloading\n", changed );
+
+	tDictionary * main = createDictionary( "Main" );
+	if ( loadConfigFiles( main, 0 ) != 0 )
+	{
+		// carry on with the old one. It'll be tried again once the file changes again
+		destroyDictionary( main );
+		memcpy( snapshot->mtime, mtime, sizeof(snapshot->mtime) );
+		return NULL;
+	}
+	copyParams( main, gCommandDict->head, NULL );
+
+	tConfigSnapshot * rebuilt = buildSnapshot( main, mtime );
+	if ( rebuilt == NULL )
+	{
+		destroyDictionary( main );
+	}
+	return rebuilt;
+}
+
+static int samePatterns( tDictionary * a, tDictionary * b )
+{
+	tParam * p = a->head;
+	tParam * q = b->head;
+
+	for (;;)
+	{
+		while ( p != NULL && p->hash != kKeywordPattern )
+		{
+			p = p->next;
+		}
+		while ( q != NULL && q->hash != kKeywordPattern )
+		{
+			q = q->next;
+		}
+		if ( p == NULL || q == NULL )
+		{
+			return p == q;
+		}
+		if ( strcmp( p->value, q->value ) != 0 )
+		{
+			return 0;
+		}
+		p = p->next;
+		q = q->next;
+	}
+}
+
+/**
+ * @brief point the globals at what's in 'snapshot'
+ */
+static void adoptSnapshot( tConfigSnapshot * snapshot )
+{
+	gSnapshot = snapshot;
+	gMainDict = snapshot->main;
+	gContext.main = NULL;   // it may be at the same address as one since released
+
+	// the destination may well be the same, but it's a different series index now
+	++gSeriesGeneration;
+	free( (void *)gCachedSeries );
+	gCachedSeries = NULL;
+	if ( snapshot->destination != NULL )
+	{
+		gCachedSeries = strdup( snapshot->destination );
+		useSnapshotSeries( snapshot );
+	}
+	else
+	{
+		gSeriesDict  = gScannedSeries;
+		gActiveCount = 0;
+		emptyDictionary( gScannedSeries );
+	}
+}
+
+/**
+ * @brief between files, switch the globals over to the latest snapshot, if there's a new one
+ */
+static void useLatestSnapshot( void )
+{
+	unsigned long epoch;
+	tConfigSnapshot * snapshot = snapshotAcquire( &epoch );
+
+	if ( snapshot != gSnapshot )
+	{
+		debugf( 1, "%s\n", "configuration reloaded" );
+		int patterns = !samePatterns( gSnapshot->main, snapshot->main );
+
+		adoptSnapshot( snapshot );
+		if ( patterns )
+		{
+			releasePatterns();
+			buildPatterns( gMainDict );
+		}
+	}
+	// the old snapshot isn't used past this point, so it may now be released
+	snapshotQuiesce( epoch );
+}
+
+/**
+ * @brief start rebuilding the config and series index in the background when they change
+ * @param interval how often to check, in seconds
+ */
+static int watchConfig( unsigned int interval )
+{
+	struct timespec mtime[ kConfigFiles ];
+
+	configFileTimes( mtime );
+	tConfigSnapshot * initial = buildSnapshot( gMainDict, mtime );
+	if ( initial == NULL )
+	{
+		return -1;
+	}
+	// even if the watcher can't be started, the snapshot now owns gMainDict
+	int result = snapshotOpen( initial, interval, rebuildSnapshot, releaseSnapshot );
+	unsigned long epoch;
+	adoptSnapshot( snapshotAcquire( &epoch ) );
+	return result;
+}
+
+
+/**
+ * @brief hash of the path to the series folder in the destination
+ */
+static tHash seriesFolderHash( string destination, string series )
+{
+    tHash hash = 0;
+
+    for ( string p = destination; *p != '\0'; p++ )
+    {
+        hash = fKeywordHashChar( hash, *p );
+    }
+    hash = fKeywordHashChar( hash, '/' );
+    for ( string p = series; *p != '\0'; p++ )
+    {
+        hash = fKeywordHashChar( hash, *p );
+    }
+    return hash;
+}
+
+/**
+ * @brief parse the names of the files in a series folder (and its season
+ *        folders), and add the episodes found to the episode index
+ */
+static void indexSeriesFolder( tDictionary * scratch, tHash folder, string path, int depth )
+{
+    char temp[ PATH_MAX ];
+    char name[ NAME_MAX + 1 ];
+    struct dirent * entry;
+
+    DIR * dir = opendir( path );
+    if ( dir == NULL )
+    {
+        return;   // not an error, the series may not be in the destination yet
+    }
+
+    while ( (entry = readdir( dir )) != NULL )
+    {
+        if ( entry->d_name[0] == '.' )
+        {
+            continue;
+        }
+
+        if ( entry->d_type == DT_DIR )
+        {
+            if ( depth > 0 )
+            {
+                snprintf( temp, sizeof(temp), "%s/%s", path, entry->d_name );
+                indexSeriesFolder( scratch, folder, temp, depth - 1 );
+            }
+        }
+        else
+        {
+            // trim the extension, the same way parsePath() does
+            strncpy( name, entry->d_name, sizeof(name) - 1 );
+            name[ sizeof(name) - 1 ] = '\0';
+            char * lastPeriod = strrchr( name, '.' );
+            if ( lastPeriod != NULL && strlen( lastPeriod ) < 5 )
+            {
+                *lastPeriod = '\0';
+            }
+
+            parseName( name );
+
+            string season  = findValue( scratch, kKeywordSeason );
+            string episode = findValue( scratch, kKeywordEpisode );
+            if ( season != NULL && episode != NULL )
+            {
+                debugf( 3, "existing: %s S%sE%s\n", path, season, episode );
+                addEpisode( folder, atoi( season ), atoi( episode ) );
+            }
+            emptyDictionary( scratch );
+        }
+    }
+    closedir( dir );
+}
+
+/**
+ * @brief combine the modification times of 'path' and the directories in it, down to
+ *        'depth' levels, i.e. those that indexSeriesFolder() reads. Zero if it doesn't exist
+ */
+static uint64_t seriesFolderStamp( string path, int depth )
+{
+    struct stat dirStat;
+    char        temp[ PATH_MAX ];
+
+    if ( stat( path, &dirStat ) != 0 )
+    {
+        return 0;
+    }
+    // a sum, so the order readdir() returns them in doesn't matter
+    uint64_t stamp = ( (uint64_t)dirStat.st_mtim.tv_sec * 1000000000ULL + dirStat.st_mtim.tv_nsec )
+                   * 0x9E3779B97F4A7C15ULL + 1;
+
+    DIR * dir = ( depth > 0 ) ? opendir( path ) : NULL;
+    if ( dir != NULL )
+    {
+        struct dirent * entry;
+        while ( (entry = readdir( dir )) != NULL )
+        {
+            if ( entry->d_name[0] != '.' && entry->d_type == DT_DIR )
+            {
+                snprintf( temp, sizeof(temp), "%s/%s", path, entry->d_name );
+                stamp += seriesFolderStamp( temp, depth - 1 );
+            }
+        }
+        closedir( dir );
+    }
+    return stamp;
+}
+
+/**
+ * @brief check if the episode just parsed is already in its series folder in the destination
+ *
+ * The series folder is scanned the first time it's asked about, and again whenever it
+ * (or a season folder in it) has changed since. The names found there are parsed with
+ * parseName(), using a scratch dictionary in place of gFileDict.
+ */
+static int isEpisodePresent( tHash * folder )
+{
+    string destination = findParam( kKeywordDestination );
+    string series      = findParam( kKeywordDestSeries );
+    string season      = findParam( kKeywordSeason );
+    string episode     = findParam( kKeywordEpisode );
+
+    if ( destination == NULL || series == NULL || season == NULL || episode == NULL )
+    {
+        return 0;
+    }
+
+    char path[ PATH_MAX ];
+    snprintf( path, sizeof(path), "%s/%s", destination, series );
+
+    *folder = seriesFolderHash( destination, series );
+    uint64_t stamp = seriesFolderStamp( path, 2 );
+    if ( !isFolderIndexed( *folder, stamp ) )
+    {
+        tDictionary * scratch = createDictionary( "Library" );
+        tDictionary * saved   = gFileDict;
+
+        debugf( 2, "indexing '%s'\n", path );
+
+        gFileDict = scratch;
+        gIndexingLibrary = 1;
+        indexSeriesFolder( scratch, *folder, path, 2 );
+        gIndexingLibrary = 0;
+        gFileDict = saved;
+
+        destroyDictionary( scratch );
+        markFolderIndexed( *folder, stamp );
+    }
+
+    return findEpisode( *folder, atoi( season ), atoi( episode ) );
+}
+
+/**
+ * @brief if the source has other links, check if one of them is in the destination library,
+ *        in any of its roots
+ * @return the path of the existing link, or NULL if there isn't one
+ */
+static string findExistingLink( string path )
+{
+    struct stat fileStat;
+    string destination = findParam( kKeywordDestination );
+
+    if ( destination == NULL || stat( path, &fileStat ) != 0 || fileStat.st_nlink < 2 )
+    {
+        return NULL;
+    }
+    string cacheDir = findParam( kKeywordConfigCache );
+    if ( gActiveCount < 2 )
+    {
+        return findLinkedPath( destination, cacheDir, fileStat.st_dev, fileStat.st_ino );
+    }
+
+    // {destination} is just the root the series is in (or will be), but a link may be in any of them
+    string existing = NULL;
+    for ( unsigned int i = 0; i < gActiveCount && existing == NULL; ++i )
+    {
+        struct stat rootStat;
+        // a hard link can only be on the same device, so don't index roots that can't have one
+        if ( stat( gActive[i]->root, &rootStat ) == 0 && rootStat.st_dev == fileStat.st_dev )
+        {
+            existing = findLinkedPath( gActive[i]->root, cacheDir, fileStat.st_dev, fileStat.st_ino );
+        }
+    }
+    return existing;
+}
+
+/**
+ * @brief make a copy of a {daterecorded} that sorts chronologically
+ *
+ * Channels DVR records YYYY-MM-DD-HHSS, and TVMosaic HHSS-YYYYMMDD, so
+ * reduce both to YYYYMMDDHHSS.
+ */
+static string sortableDate( string recorded )
+{
+    char * result = malloc( strlen( recorded ) + 1 );
+    char * d = result;
+    string hhss = NULL;
+
+    if ( result == NULL )
+    {
+        return NULL;
+    }
+    if ( strlen( recorded ) == 13 && recorded[4] == '-' )
+    {
+        hhss = recorded;       // TVMosaic, the time comes first
+        recorded += 5;
+    }
+    for ( string s = recorded; *s != '\0'; s++ )
+    {
+        if ( isdigit( *s ) )
+        {
+            *d++ = *s;
+        }
+    }
+    if ( hhss != NULL )
+    {
+        memcpy( d, hhss, 4 );
+        d += 4;
+    }
+    *d = '\0';
+    return result;
+}
+
+/**
+ * @brief expand a template using the current dictionaries, and add the result to the outputs
+ */
+static void addOutput( tResolved * resolved, string template, int execute )
+{
+    if ( resolved->count >= kMaxOutputs )
+    {
+        fprintf( stderr, "### Error: too many templates, ignored \'%s\'\n", template );
+        return;
+    }
+
+    debugf( 2, "template = \'%s\'\n", template );
+
+    traceBegin( "build", NULL );
+    uint64_t start = stageStart();
+    string built = buildString( template );
+    stageStop( kStageBuild, start );
+    traceEnd( "build" );
+
+    if ( built != NULL )
+    {
+        resolved->output[ resolved->count ].built   = built;
+        resolved->output[ resolved->count ].execute = execute;
+        ++resolved->count;
+    }
+}
+
+/**
+ * @brief hash a parameter name made of a prefix and a name, e.g. 'template' and 'link'
+ *        hashes the same as 'template.link' does in a config file
+ */
+static tHash hashQualifiedName( string prefix, string name )
+{
+    tHash hash = 0;
+
+    for ( string p = prefix; *p != '\0'; p++ )
+    {
+        hash = fKeywordHashChar( hash, *p );
+    }
+    for ( string p = name; *p != '\0'; p++ )
+    {
+        hash = fKeywordHashChar( hash, *p );
+    }
+    return hash;
+}
+
+/**
+ * @brief expand each of the named templates in 'templates', e.g. 'link nfo'
+ *
+ * For each name, 'template.<name>' is the template to expand, and 'action.<name>'
+ * says whether to 'print' or 'execute' the result. If there's no action for it,
+ * the -x option (or 'execute' parameter) decides, as it does for a lone template.
+ * A name without a template is reported, but the others are still expanded.
+ */
+static int addNamedOutputs( tResolved * resolved, string templates )
+{
+    int  result = 0;
+    char name[ 64 ];
+    string t = templates;
+
+    while ( *t != '\0' )
+    {
+        size_t length = 0;
+
+        while ( *t == ' ' || *t == ',' || *t == '\t' )
+        {
+            t++;
+        }
+        while ( *t != '\0' && *t != ' ' && *t != ',' && *t != '\t' )
+        {
+            if ( length < sizeof(name) - 1 )
+            {
+                name[ length++ ] = *t;
+            }
+            t++;
+        }
+        name[ length ] = '\0';
+
+        if ( length > 0 )
+        {
+            string template = findParam( hashQualifiedName( "template", name ) );
+            string action   = findParam( hashQualifiedName( "action", name ) );
+
+            if ( template == NULL )
+            {
+                fprintf( stderr, "### Error: no template.%s found.\n", name );
+                result = -2;
+            }
+            else
+            {
+                int execute = ( action != NULL ) ? strcasecmp( action, "execute" ) == 0
+                                                 : findParam( kKeywordExecute ) != NULL;
+                addOutput( resolved, template, execute );
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief work out what to do with a single source file, but don't do it yet
+ * @param path      the source file
+ * @param recording what Channels DVR knows about it, or NULL to parse the name
+ * @param resolved filled in with the result, to be passed to runFile()
+ * @return
+ */
+int resolveFile( string path, tRecording * recording, tResolved * resolved )
+{
+    int result = 0;
+
+    memset( resolved, 0, sizeof(tResolved) );
+
+    ++gFileCount;
+    metricIncrement( kMetricFiles );
+    uint64_t start = metricClock();
+    traceBegin( "file", path );
+
+    traceBegin( "config", NULL );
+    uint64_t stage = stageStart();
+    processConfigPath( path );
+    stageStop( kStageConfig, stage );
+    traceEnd( "config" );
+
+    traceBegin( "parse", NULL );
+    if ( recording != NULL )
+    {
+        parseRecording( path, recording );
+    }
+    else
+    {
+        parsePath( path );
+    }
+    lookupGuide();
+    traceEnd( "parse" );
+
+    if ( findParam( kKeywordSeries ) == NULL || findParam( kKeywordEpisode ) == NULL )
+    {
+        metricIncrement( kMetricParseFailures );
+    }
+
+    // a series that's not in any of the roots yet goes in the first one
+    if ( gActiveCount > 1 && findValue( gFileDict, kKeywordDestination ) == NULL )
+    {
+        addParamRef( gFileDict, kKeywordDestination, gActive[0]->root );
+    }
+
+    printDictionary( gFileDict );
+
+    string template  = findParam( kKeywordTemplate );
+    string templates = findParam( kKeywordTemplates );
+
+    string linked   = findParam( kKeywordLinked );
+    string existing = ( linked != NULL ) ? findExistingLink( path ) : NULL;
+    if ( existing != NULL )
+    {
+        fprintf( stderr, "\'%s\' is already linked as \'%s\'\n", path, existing );
+    }
+
+    if ( template == NULL && templates == NULL )
+    {
+        fprintf( stderr, "### Error: no template found.\n" );
+        result = -2;
+    }
+    else if ( existing != NULL && strcasecmp( linked, "skip" ) == 0 )
+    {
+        /* already reported */
+    }
+    else if ( findParam( kKeywordSkipExisting ) != NULL && isEpisodePresent( &resolved->folder ) )
+    {
+        fprintf( stderr, "skipped \'%s\', S%sE%s is already in \'%s\'\n", path,
+                 findParam( kKeywordSeason ), findParam( kKeywordEpisode ), findParam( kKeywordDestSeries ) );
+        resolved->folder = 0;
+    }
+    else
+    {
+        if ( templates != NULL )
+        {
+            result = addNamedOutputs( resolved, templates );
+        }
+        else
+        {
+            addOutput( resolved, template, findParam( kKeywordExecute ) != NULL );
+        }
+        metricObserve( kHistogramResolve, start );
+
+        string destination = findParam( kKeywordDestination );
+        string series      = findParam( kKeywordDestSeries );
+        string season      = findParam( kKeywordSeason );
+        string episode     = findParam( kKeywordEpisode );
+        if ( season != NULL && episode != NULL )
+        {
+            resolved->season  = atoi( season );
+            resolved->episode = atoi( episode );
+
+            if ( destination != NULL && series != NULL )
+            {
+                tHash episodeKey = (tHash)( resolved->season << 16 | resolved->episode );
+                resolved->key = seriesFolderHash( destination, series ) ^ ( episodeKey * 0x9E3779B97F4A7C15UL );
+            }
+        }
+
+        // identical content is a better test of a duplicate than the name, if asked for
+        string dedupe = findParam( kKeywordDedupe );
+        if ( dedupe != NULL && strcasecmp( dedupe, "fingerprint" ) == 0 )
+        {
+            tFingerprint fingerprint;
+            if ( fingerprintFile( path, &fingerprint ) == 0 )
+            {
+                resolved->key = fingerprint.high ^ fingerprint.low;
+            }
+        }
+
+        string recorded = findParam( kKeywordDateRecorded );
+        if ( recorded != NULL )
+        {
+            resolved->recorded = sortableDate( recorded );
+        }
+
+        if ( findParam( kKeywordNotifyURL ) != NULL )
+        {
+            string notifyPath = findParam( kKeywordNotifyPath );
+            resolved->notify = buildString( notifyPath != NULL ? notifyPath : "{destination}/{destseries}" );
+        }
+    }
+    emptyDictionary( gFileDict );
+    freePath();
+    traceEnd( "file" );
+    return result;
+}
+
+/**
+ * @brief act on a source file that has been resolved
+ * @param output if not NULL, the generated strings that would be printed are handed
+ *               back to the caller instead (who is then responsible for freeing them)
+ */
+int runFile( tResolved * resolved, string * output )
+{
+    int result   = 0;
+    int executed = 0;
+
+    for ( unsigned int i = 0; i < resolved->count; ++i )
+    {
+        string built = resolved->output[i].built;
+
+        checkpointOutput( built );
+
+        if ( resolved->output[i].execute )
+        {
+	        traceBegin( "action", NULL );
+	        fflush( stdout );   // keep anything already printed ahead of the command's output
+	        uint64_t start = metricClock();
+	        int status = system( built );
+	        metricObserve( kHistogramAction, start );
+	        metricIncrement( kMetricActions );
+	        if ( status != 0 )
+	        {
+		        metricIncrement( kMetricActionFailures );
+		        result = status;
+	        }
+	        ++executed;
+	        traceEnd( "action" );
+        }
+        else if ( output != NULL )
+        {
+	        if ( *output == NULL )
+	        {
+		        *output = built;
+		        built = NULL;
+	        }
+	        else
+	        {
+		        // more than one template, so one line each
+		        char * joined = malloc( strlen( *output ) + strlen( built ) + 2 );
+		        if ( joined != NULL )
+		        {
+			        sprintf( joined, "%s\n%s", *output, built );
+			        free( (void *)*output );
+			        *output = joined;
+		        }
+	        }
+        }
+        else
+        {
+	        printf( "%s\n", built );
+        }
+        free( (void *)built );
+        resolved->output[i].built = NULL;
+    }
+
+    if ( executed > 0 && result == 0 )
+    {
+        if ( resolved->folder != 0 )
+        {
+            // it's there now, so skip any later copies of the same episode
+            addEpisode( resolved->folder, resolved->season, resolved->episode );
+        }
+        if ( resolved->notify != NULL )
+        {
+            notifyAdd( resolved->notify );
+        }
+    }
+
+    free( (void *)resolved->recorded );
+    free( (void *)resolved->notify );
+    resolved->count    = 0;
+    resolved->recorded = NULL;
+    resolved->notify   = NULL;
+
+    return result;
+}
+
+/**
+ * @brief process a single source file
+ * @param path   the source file
+ * @param output if not NULL, the generated string is handed back to the caller
+ *               (who is then responsible for freeing it) rather than printed
+ * @return
+ */
+int processFile( string path, string * output )
+{
+    tResolved resolved;
+
+    // even if one of the templates was missing, act on the rest (which also frees them)
+    int result = resolveFile( path, NULL, &resolved );
+    int status = runFile( &resolved, output );
+
+    return ( result != 0 ) ? result : status;
+}
+
+static int compareBatchDirectory( const void * a, const void * b )
+{
+	const tBatchEntry * entryA = a;
+	const tBatchEntry * entryB = b;
+	int result;
+
+	size_t length = entryA->dirLength < entryB->dirLength ? entryA->dirLength : entryB->dirLength;
+	result = memcmp( entryA->path, entryB->path, length );
+	if ( result == 0 )
+	{
+		result = (entryA->dirLength > entryB->dirLength) - (entryA->dirLength < entryB->dirLength);
+	}
+	if ( result == 0 )
+	{
+		// keep the original order within a directory
+		result = (entryA->index > entryB->index) - (entryA->index < entryB->index);
+	}
+	return result;
+}
+
+static int compareBatchIndex( const void * a, const void * b )
+{
+	const tBatchEntry * entryA = a;
+	const tBatchEntry * entryB = b;
+
+	return (entryA->index > entryB->index) - (entryA->index < entryB->index);
+}
+
+/*
+   stdin is read through this buffer rather than stdio's, so that it's possible to
+   tell whether the rest of a burst of input has already arrived before waiting
+ */
+static struct {
+    char   data[ 8192 ];
+    size_t start;
+    size_t end;
+} gInput;
+
+/**
+ * @brief while reading from stdin, if there are media server notifications
+ *        waiting, send them once the input has been quiet for 'notifydelay' seconds
+ */
+static void waitForInput( int fd )
+{
+    if ( notifyPending() )
+    {
+        string delay = findParam( kKeywordNotifyDelay );
+        struct pollfd polled = { fd, POLLIN, 0 };
+
+        if ( poll( &polled, 1, ( delay != NULL ? atoi( delay ) : 30 ) * 1000 ) == 0 )
+        {
+            notifyFlush();
+        }
+    }
+}
+
+/**
+ * @brief read the next line from stdin, up to 'terminator' (which isn't stored). Like
+ *        fgets(), a line too long for 'line' is returned in pieces
+ * @return the number of bytes read, including the terminator, or 0 at the end of the input
+ */
+static size_t readInput( char * line, size_t size, char terminator )
+{
+    size_t length   = 0;
+    size_t consumed = 0;
+
+    while ( length < size - 1 )
+    {
+        if ( gInput.start == gInput.end )
+        {
+            // only wait if there's nothing buffered
+            waitForInput( STDIN_FILENO );
+            ssize_t count = read( STDIN_FILENO, gInput.data, sizeof(gInput.data) );
+            if ( count < 0 && errno == EINTR )
+            {
+                continue;
+            }
+            if ( count <= 0 )
+            {
+                break;
+            }
+            gInput.start = 0;
+            gInput.end   = (size_t)count;
+        }
+
+        char c = gInput.data[ gInput.start++ ];
+        ++consumed;
+        if ( c == terminator )
+        {
+            break;
+        }
+        line[ length++ ] = c;
+    }
+    line[ length ] = '\0';
+    return consumed;
+}
+
+/**
+ * @brief either process an input immediately, or hold onto it for later if in batch mode
+ * @param path
+ */
+int processInput( string path )
+{
+	int result = 0;
+
+	if ( gSnapshot != NULL )
+	{
+		useLatestSnapshot();
+	}
+
+	// if resuming from a checkpoint, skip over what was done last time
+	int skip = checkpointSkip( path );
+	if ( skip < 0 )
+	{
+		exit( EXIT_FAILURE );
+	}
+	if ( skip > 0 )
+	{
+		return 0;
+	}
+
+	if ( gBatchOrder == kBatchOff )
+	{
+		result = processFile( path, NULL );
+		checkpointInput( path, gInputOffset );
+	}
+	else
+	{
+		if ( gBatchCount >= gBatchSize )
+		{
+			gBatchSize = ( gBatchSize == 0 ) ? 256 : gBatchSize * 2;
+			gBatch = realloc( gBatch, gBatchSize * sizeof(tBatchEntry) );
+			if ( gBatch == NULL )
+			{
+				fprintf( stderr, "### Error: unable to allocate memory for batch (%d: %s)\n",
+				         errno, strerror(errno) );
+				exit( errno );
+			}
+		}
+
+		tBatchEntry * entry = &gBatch[ gBatchCount ];
+		entry->path   = strdup( path );
+		entry->index  = gBatchCount;
+		entry->output = NULL;
+
+		string lastSlash = strrchr( path, '/' );
+		entry->dirLength = ( lastSlash != NULL ) ? (size_t)(lastSlash - path) : 0;
+
+		++gBatchCount;
+	}
+	return result;
+}
+
+/**
+ * @brief should batch entry 'a' be acted upon in preference to 'b'?
+ * @param prefer 'largest', 'newest' (by {daterecorded}), or a path prefix
+ */
+static int isPreferred( const tBatchEntry * a, const tBatchEntry * b, string prefer )
+{
+	if ( prefer == NULL )
+	{
+		return 0;   // no preference, so keep the first one
+	}
+	if ( strcasecmp( prefer, "largest" ) == 0 )
+	{
+		return a->resolved.size > b->resolved.size;
+	}
+	if ( strcasecmp( prefer, "newest" ) == 0 )
+	{
+		return a->resolved.recorded != NULL
+		    && ( b->resolved.recorded == NULL || strcmp( a->resolved.recorded, b->resolved.recorded ) > 0 );
+	}
+	size_t length = strlen( prefer );
+	return strncmp( a->path, prefer, length ) == 0 && strncmp( b->path, prefer, length ) != 0;
+}
+
+/**
+ * @brief group the resolved batch entries by (destseries, season, episode), or
+ *        by content if 'dedupe = fingerprint', and drop all but the preferred
+ *        entry in each group
+ */
+static void resolveDuplicates( string prefer )
+{
+	size_t size = 16;
+	while ( size < (size_t)gBatchCount * 2 )
+	{
+		size *= 2;
+	}
+
+	unsigned int * table = malloc( size * sizeof(unsigned int) );
+	if ( table == NULL )
+	{
+		return;   // no worse than not having asked for it
+	}
+	memset( table, 0xFF, size * sizeof(unsigned int) );
+
+	int largest = ( prefer != NULL && strcasecmp( prefer, "largest" ) == 0 );
+
+	for ( unsigned int i = 0; i < gBatchCount; ++i )
+	{
+		tBatchEntry * entry = &gBatch[i];
+		if ( entry->resolved.count == 0 || entry->resolved.key == 0 )
+		{
+			continue;
+		}
+
+		if ( largest )
+		{
+			struct stat fileStat;
+			entry->resolved.size = ( stat( entry->path, &fileStat ) == 0 ) ? fileStat.st_size : 0;
+		}
+
+		size_t slot = entry->resolved.key & (size - 1);
+		while ( table[ slot ] != UINT_MAX && gBatch[ table[ slot ] ].resolved.key != entry->resolved.key )
+		{
+			slot = (slot + 1) & (size - 1);
+		}
+		if ( table[ slot ] == UINT_MAX )
+		{
+			table[ slot ] = i;
+			continue;
+		}
+
+		tBatchEntry * winner = &gBatch[ table[ slot ] ];
+		tBatchEntry * loser  = entry;
+		if ( isPreferred( entry, winner, prefer ) )
+		{
+			loser  = winner;
+			winner = entry;
+			table[ slot ] = i;
+		}
+		fprintf( stderr, "skipped \'%s\', it\'s a duplicate of \'%s\'\n", loser->path, winner->path );
+		for ( unsigned int j = 0; j < loser->resolved.count; ++j )
+		{
+			free( (void *)loser->resolved.output[j].built );
+		}
+		loser->resolved.count = 0;
+	}
+	free( table );
+}
+
+/**
+ * @brief process all the inputs collected in batch mode, one directory at a time
+ */
+int processBatch( void )
+{
+	int result = 0;
+
+	qsort( gBatch, gBatchCount, sizeof(tBatchEntry), compareBatchDirectory );
+
+	for ( unsigned int i = 0; i < gBatchCount; ++i )
+	{
+		debugf( 4, "batch %u: \'%s\'\n", gBatch[i].index, gBatch[i].path );
+		resolveFile( gBatch[i].path, NULL, &gBatch[i].resolved );
+	}
+
+	string prefer = findValue( gMainDict, kKeywordPrefer );
+	if ( prefer != NULL || findValue( gMainDict, kKeywordDedupe ) != NULL )
+	{
+		resolveDuplicates( prefer );
+	}
+
+	for ( unsigned int i = 0; i < gBatchCount; ++i )
+	{
+		runFile( &gBatch[i].resolved, &gBatch[i].output );
+	}
+
+	if ( gBatchOrder == kBatchOriginal )
+	{
+		qsort( gBatch, gBatchCount, sizeof(tBatchEntry), compareBatchIndex );
+	}
+
+	for ( unsigned int i = 0; i < gBatchCount; ++i )
+	{
+		if ( gBatch[i].output != NULL )
+		{
+			printf( "%s\n", gBatch[i].output );
+			free( (void *)gBatch[i].output );
+		}
+		free( (void *)gBatch[i].path );
+	}
+
+	free( gBatch );
+	gBatch      = NULL;
+	gBatchCount = 0;
+	gBatchSize  = 0;
+
+	return result;
+}
+
+/**
+ * @brief act on a recording from a Channels DVR export, see recordings.c
+ * @param context the folder the recordings' paths are relative to, if any
+ */
+static void importRecording( void * context, tRecording * recording )
+{
+	string    root = context;
+	char      path[ PATH_MAX ];
+	tResolved resolved;
+
+	if ( recording->deleted )
+	{
+		debugf( 2, "skipping deleted recording \'%s\'\n", recording->path );
+		return;
+	}
+
+	// the paths in an export are usually relative to the recordings folder
+	string source = recording->path;
+	if ( source[0] != '/' && root != NULL )
+	{
+		if ( snprintf( path, sizeof(path), "%s/%s", root, recording->path ) >= (int)sizeof(path) )
+		{
+			fprintf( stderr, "### Error: the path of \'%s\' is too long\n", recording->path );
+			return;
+		}
+		source = path;
+	}
+
+	// even if one of the templates was missing, act on the rest (which also frees them)
+	resolveFile( source, recording, &resolved );
+	runFile( &resolved, NULL );
+}
+
+/**
+ * @brief process each recording in a Channels DVR JSON export
+ * @param source the file to read, or '-' for stdin
+ */
+int importRecordings( string source )
+{
+	FILE * input = stdin;
+
+	if ( strcmp( source, "-" ) != 0 )
+	{
+		input = fopen( source, "r" );
+		if ( input == NULL )
+		{
+			fprintf( stderr, "### Error: unable to open \'%s\' (%d: %s)\n",
+			         source, errno, strerror(errno) );
+			return -1;
+		}
+	}
+
+	int result = readRecordings( input, importRecording, (void *)findParam( kKeywordRecordings ) );
+
+	if ( input != stdin )
+	{
+		fclose( input );
+	}
+	return result;
+}
+
+/*
+   Audit mode. Rather than feeding the names of files already in the library
+   through the whole pipeline, walk the library in parallel to collect them,
+   then check each one in turn against the layout it would have been given:
+   that its parsed series matches the series folder it's in, that it's in the
+   right season folder, and that it has an SxxEyy at all.
+ */
+#define kAuditLayout        "{destination}/{destseries}/{seasonfolder}/{basename}{extension}"
+#define kAuditExtensions    ".mkv .mp4 .m4v .ts .avi .mpg .wtv"
+
+typedef struct {
+	string       extensions;
+	string *     paths;
+	unsigned int count;
+	unsigned int size;
+} tAudit;
+
+/**
+ * @brief is 'extension' one of the space-separated ones in 'list'?
+ */
+static int isAuditedExtension( string list, string extension )
+{
+	size_t length = strlen( extension );
+
+	for ( string p = list; *p != '\0'; )
+	{
+		while ( *p == ' ' )
+		{
+			++p;
+		}
+		string end = p;
+		while ( *end != ' ' && *end != '\0' )
+		{
+			++end;
+		}
+		if ( (size_t)(end - p) == length && length > 0 && strncasecmp( p, extension, length ) == 0 )
+		{
+			return 1;
+		}
+		p = end;
+	}
+	return 0;
+}
+
+static void collectAuditEntry( void * context, const tWalkEntry * entry )
+{
+	tAudit * audit = context;
+
+	string name = strrchr( entry->path, '/' );
+	name = ( name != NULL ) ? name + 1 : entry->path;
+	string extension = strrchr( name, '.' );
+
+	if ( !S_ISREG( entry->mode ) || name[0] == '.' || extension == NULL
+	  || !isAuditedExtension( audit->extensions, extension ) )
+	{
+		return;
+	}
+
+	if ( audit->count == audit->size )
+	{
+		unsigned int size  = ( audit->size == 0 ) ? 1024 : audit->size * 2;
+		string *     paths = realloc( audit->paths, size * sizeof(string) );
+		if ( paths == NULL )
+		{
+			return;
+		}
+		audit->paths = paths;
+		audit->size  = size;
+	}
+	string path = strdup( entry->path );
+	if ( path != NULL )
+	{
+		audit->paths[ audit->count++ ] = path;
+	}
+}
+
+static int compareAuditPath( const void * a, const void * b )
+{
+	return strcmp( *(const string *)a, *(const string *)b );
+}
+
+/**
+ * @brief how many characters 'a' and 'b' have in common before they differ at a directory
+ * @param depth the number of directories that are the same
+ */
+static size_t commonDirectories( string a, string b, unsigned int * depth )
+{
+	size_t common = 0;
+
+	*depth = 0;
+	for ( size_t i = 0; a[i] != '\0' && a[i] == b[i]; ++i )
+	{
+		if ( a[i] == '/' )
+		{
+			common = i + 1;
+			++*depth;
+		}
+	}
+	return common;
+}
+
+static unsigned int countDirectories( string path )
+{
+	unsigned int count = 0;
+
+	for ( string p = strchr( path, '/' ); p != NULL; p = strchr( p + 1, '/' ) )
+	{
+		++count;
+	}
+	return count;
+}
+
+/**
+ * @brief check a single file in the library, and print the difference if it's not where it should be
+ * @return 0 if it's fine, 1 if it's in the wrong place, 2 if it has no SxxEyy
+ */
+static int auditFile( string root, string path, string layout )
+{
+	int    result     = 0;
+	size_t rootLength = strlen( root );
+	string relative   = path + rootLength + 1;
+
+	addParamRef( gFileDict, kKeywordDestination, root );
+	parsePath( path );
+
+	if ( findParam( kKeywordDestSeries ) == NULL || findParam( kKeywordEpisode ) == NULL )
+	{
+		printf( "? %s\t# no SxxEyy\n", relative );
+		result = 2;
+	}
+	else
+	{
+		string expected = buildString( layout );
+		if ( expected != NULL && strcmp( expected, path ) != 0 )
+		{
+			string shown = expected;
+			if ( strncmp( expected, root, rootLength ) == 0 && expected[ rootLength ] == '/' )
+			{
+				shown = expected + rootLength + 1;
+			}
+
+			// the first directory that differs says what's wrong
+			unsigned int depth;
+			size_t common = commonDirectories( relative, shown, &depth );
+			string reason;
+			if ( shown == expected || depth == 0 )
+			{
+				reason = "series folder";
+			}
+			else if ( countDirectories( relative ) < countDirectories( shown ) )
+			{
+				reason = "no season folder";
+			}
+			else if ( strchr( relative + common, '/' ) != NULL || strchr( shown + common, '/' ) != NULL )
+			{
+				reason = "season folder";
+			}
+			else
+			{
+				reason = "name";
+			}
+
+			printf( "- %s\n+ %s\t# %s\n", relative, shown, reason );
+			result = 1;
+		}
+		free( (void *)expected );
+	}
+
+	emptyDictionary( gFileDict );
+	freePath();
+	return result;
+}
+
+/**
+ * @brief check every file in the library under 'root' against the naming rules
+ */
+int auditLibrary( string root )
+{
+	tAudit       audit;
+	unsigned int misplaced = 0;
+	unsigned int unparsed  = 0;
+	char         temp[ PATH_MAX ];
+
+	// trailing slashes would throw off the relative paths
+	snprintf( temp, sizeof(temp), "%s", root );
+	for ( size_t length = strlen( temp ); length > 1 && temp[ length - 1 ] == '/'; --length )
+	{
+		temp[ length - 1 ] = '\0';
+	}
+	root = temp;
+
+	struct stat rootStat;
+	if ( stat( root, &rootStat ) != 0 || !S_ISDIR( rootStat.st_mode ) )
+	{
+		fprintf( stderr, "### Error: unable to audit \'%s\' (%d: %s)\n",
+		         root, errno, strerror(errno) );
+		return -1;
+	}
+
+	uint64_t start = metricClock();
+
+	memset( &audit, 0, sizeof(audit) );
+	audit.extensions = findParam( kKeywordAuditExtensions );
+	if ( audit.extensions == NULL )
+	{
+		audit.extensions = kAuditExtensions;
+	}
+
+	traceBegin( "scan", root );
+	walkTree( root, 0, collectAuditEntry, &audit );
+	traceEnd( "scan" );
+	qsort( audit.paths, audit.count, sizeof(string), compareAuditPath );
+
+	// the series folders to match against are the ones in the library being audited
+	if ( gCachedSeries == NULL || strcmp( gCachedSeries, root ) != 0 )
+	{
+		++gSeriesGeneration;
+		free( (void *)gCachedSeries );
+		gCachedSeries = strdup( root );
+		selectSeriesSegments( root );
+	}
+
+	string layout = findParam( hashQualifiedName( "template", "path" ) );
+	if ( layout == NULL )
+	{
+		layout = kAuditLayout;
+	}
+
+	for ( unsigned int i = 0; i < audit.count; ++i )
+	{
+		switch ( auditFile( root, audit.paths[i], layout ) )
+		{
+		case 1:  ++misplaced; break;
+		case 2:  ++unparsed;  break;
+		default: break;
+		}
+		free( (void *)audit.paths[i] );
+	}
+	free( audit.paths );
+
+	fflush( stdout );
+	fprintf( stderr, "audited %u files in %.2fs: %u misplaced, %u without SxxEyy\n",
+	         audit.count, (double)( metricClock() - start ) / 1e6, misplaced, unparsed );
+
+	return ( misplaced + unparsed > 0 ) ? 1 : 0;
 }
 
+/*
+   Golden mode, to catch a change to what's output for a set of paths, or to
+   how long it takes to work out. Each line of the golden file is a source
+   path, a tab, and the output expected for it, with any newline, tab or
+   backslash in it escaped. Every path is resolved as usual, but nothing is
+   executed, and any output that differs is listed. A path that doesn't have
+   an expected output yet has its output printed as a golden file line, so a
+   golden file can be started from a plain list of paths.
+
+   Then the paths are run through a few more times, and the fastest time per
+   file for each stage is reported. If 'golden baseline' names a file that
+   already exists, each stage has to be within 'golden budget' percent of the
+   time recorded in it. Otherwise, the times are recorded there.
+ */
+#define kGoldenPasses   5
+#define kGoldenBudget   25      // percent
+
+typedef struct {
+	char       * path;          // the line read from the golden file
+	string       expected;      // points into the same line, or NULL
+} tGolden;
+
 /**
- * @brief recurive function to walk the path looking for config files
- * @param gFileDict
- * @param path
+ * @brief a copy of 'output' that fits on one line of a golden file
  */
-void _recurseConfig( tDictionary * dictionary, string path )
+static char * escapeGolden( string output )
 {
-	char temp[PATH_MAX];
+	char * result = malloc( 2 * strlen( output ) + 1 );
+	char * d = result;
 
-	if ( strlen(path) != 1 || (path[0] != '/' && path[0] != '.'))
+	if ( result == NULL )
 	{
-		strncpy( temp, path, sizeof( temp ) );
-		_recurseConfig( dictionary, dirname( temp ) );
-		/* check for a config file & if found, parse it */
-		debugf( 4, "recurse = \'%s\'\n", path );
-		snprintf( temp, sizeof(temp), "%s/%s.conf", path, gMyName );
-		parseConfigFile( dictionary, temp );
+		return NULL;
+	}
+	for ( string s = output; *s != '\0'; s++ )
+	{
+		switch ( *s )
+		{
+		case '\n': *d++ = '\\'; *d++ = 'n';  break;
+		case '\t': *d++ = '\\'; *d++ = 't';  break;
+		case '\\': *d++ = '\\'; *d++ = '\\'; break;
+		default:   *d++ = *s; break;
+		}
 	}
+	*d = '\0';
+	return result;
 }
 
 /**
-   Traverse the path to the source file, looking for config files.
-   Apply them in the reverse order, so ones lower in the hierarchy
-   can override parameters defined in higher ones.
+ * @brief resolve 'path' as usual, but hand back what would have been output, escaped
  */
-int processConfigPath( string path )
+static char * resolveGolden( string path )
 {
-	int  result = 0;
-	char temp[PATH_MAX];
-	char * absolute;
+	tResolved resolved;
+	string    output = NULL;
 
-	/* dirname may modify its argument, so make a copy first */
-	strncpy( temp, path, sizeof(temp) );
-	absolute = realpath( dirname(temp), NULL );
-	if ( absolute == NULL )
+	resolveFile( path, NULL, &resolved );
+	for ( unsigned int i = 0; i < resolved.count; ++i )
 	{
-		fprintf( stderr, "### Error: path \'%s\' appears to be invalid (%d: %s).\n",
-				 path, errno, strerror(errno) );
-		return -5;
+		resolved.output[i].execute = 0;
 	}
-	else
+	runFile( &resolved, &output );
+
+	char * result = escapeGolden( output != NULL ? output : "" );
+	free( (void *)output );
+	return result;
+}
+
+static tGolden * readGolden( string file, unsigned int * count )
+{
+	tGolden    * golden = NULL;
+	unsigned int size   = 0;
+	char       * line   = NULL;
+	size_t       length = 0;
+	ssize_t      read;
+
+	FILE * input = fopen( file, "r" );
+	if ( input == NULL )
 	{
-		debugf( 3, "abs = %s, cached = %s\n", absolute, gCachedPath );
-		if ( gCachedPath == NULL || strcmp( gCachedPath, absolute ) != 0 )
+		fprintf( stderr, "### Error: unable to open \'%s\' (%d: %s)\n",
+		         file, errno, strerror(errno) );
+		return NULL;
+	}
+
+	*count = 0;
+	while ( ( read = getline( &line, &length, input ) ) >= 0 )
+	{
+		while ( read > 0 && ( line[ read - 1 ] == '\n' || line[ read - 1 ] == '\r' ) )
 		{
-			debugf( 3, "absolute = \'%s\'\n", absolute );
-			emptyDictionary( gPathDict );
-			gCachedPath = absolute;
-			_recurseConfig( gPathDict, absolute );
+			line[ --read ] = '\0';
 		}
+		if ( read == 0 || line[0] == '#' )
+		{
+			continue;
+		}
+
+		if ( *count >= size )
+		{
+			size = ( size == 0 ) ? 256 : size * 2;
+			tGolden * grown = realloc( golden, size * sizeof(tGolden) );
+			if ( grown == NULL )
+			{
+				fprintf( stderr, "### Error: unable to allocate memory for \'%s\' (%d: %s)\n",
+				         file, errno, strerror(errno) );
+				break;
+			}
+			golden = grown;
+		}
+
+		char * tab = strchr( line, '\t' );
+		if ( tab != NULL )
+		{
+			*tab++ = '\0';
+		}
+		golden[ *count ].path     = line;
+		golden[ *count ].expected = tab;
+		++*count;
+
+		line   = NULL;  // it belongs to the entry now
+		length = 0;
+	}
+	free( line );
+	fclose( input );
+
+	if ( golden == NULL )
+	{
+		golden = malloc( sizeof(tGolden) );     // an empty golden file is not an error
+	}
+	return golden;
+}
 
-		/* we may have picked up a new definition of {destination} as
-		 * a result of parsing different config files. If so, we need
-		 * to rebuild gSeriesDict to reflect the new destination */
+/**
+ * @brief compare the stage times (in ns/file) against those in 'baseline', or record them there
+ * @return the number of stages that were over budget
+ */
+static unsigned int checkStageBudgets( string baseline, const uint64_t * nanos )
+{
+	unsigned int over = 0;
+	char         stage[ 32 ];
+	unsigned long long recorded;
 
-		string destination = findParam( kKeywordDestination );
+	string budgetParam = findParam( kKeywordGoldenBudget );
+	unsigned int budget = ( budgetParam != NULL ) ? (unsigned int)atoi( budgetParam ) : kGoldenBudget;
 
-		if ( destination == NULL)
+	FILE * file = fopen( baseline, "r" );
+	if ( file == NULL )
+	{
+		file = fopen( baseline, "w" );
+		if ( file == NULL )
 		{
-			fprintf( stderr, "### Error: no destination defined.\n" );
-			result = -3;
+			fprintf( stderr, "### Error: unable to record the baseline in \'%s\' (%d: %s)\n",
+			         baseline, errno, strerror(errno) );
+			return 0;
 		}
-		else
+		for ( unsigned int i = 0; i < kStageCount; ++i )
+		{
+			fprintf( file, "%s %llu\n", kStageNames[i], (unsigned long long)nanos[i] );
+		}
+		fclose( file );
+		fprintf( stderr, "recorded the baseline in \'%s\'\n", baseline );
+		return 0;
+	}
+
+	while ( fscanf( file, "%31s %llu", stage, &recorded ) == 2 )
+	{
+		for ( unsigned int i = 0; i < kStageCount; ++i )
 		{
-			if ( gCachedSeries == NULL || strcmp( gCachedSeries, destination ) != 0 )
+			if ( strcmp( stage, kStageNames[i] ) == 0 )
 			{
-				debugf( 2, "destination = \'%s\'\n", destination );
-				// fill the dictionary with hashes of the directory names in the destination
-				emptyDictionary( gSeriesDict );
-				gCachedSeries = destination;
-				buildSeriesDictionary( destination );
+				unsigned long long limit = recorded + recorded * budget / 100;
+				if ( nanos[i] > limit )
+				{
+					fprintf( stderr, "### Error: %s took %llu ns/file, over its budget of %llu"
+					                 " (%llu in the baseline, plus %u%%)\n",
+					         kStageNames[i], (unsigned long long)nanos[i], limit, recorded, budget );
+					++over;
+				}
 			}
 		}
 	}
-	return result;
+	fclose( file );
+	return over;
 }
 
-int processFile( string path )
+/**
+ * @brief check the output for each path in 'file' is what's expected, and how long it took
+ * @return 0 if it's all as expected, 1 if not, or -1 if the golden file couldn't be read
+ */
+int checkGolden( string file )
 {
-    int result = 0;
+	unsigned int count;
+	unsigned int different = 0;
+	unsigned int added     = 0;
+	uint64_t     fastest[ kStageCount ];
 
-    processConfigPath( path );
+	tGolden * golden = readGolden( file, &count );
+	if ( golden == NULL )
+	{
+		return -1;
+	}
 
-	parsePath( path );
+	for ( unsigned int i = 0; i < count; ++i )
+	{
+		char * actual = resolveGolden( golden[i].path );
 
-    printDictionary( gFileDict );
+		if ( actual == NULL )
+		{
+			++different;
+		}
+		else if ( golden[i].expected == NULL )
+		{
+			printf( "%s\t%s\n", golden[i].path, actual );
+			++added;
+		}
+		else if ( strcmp( actual, golden[i].expected ) != 0 )
+		{
+			printf( "! %s\n- %s\n+ %s\n", golden[i].path, golden[i].expected, actual );
+			++different;
+		}
+		free( actual );
+	}
+
+	// the first pass also warmed up the caches, so these are all measured alike
+	gTimingStages = 1;
+	for ( unsigned int pass = 0; pass < kGoldenPasses && count > 0; ++pass )
+	{
+		memset( gStageNanos, 0, sizeof(gStageNanos) );
+		for ( unsigned int i = 0; i < count; ++i )
+		{
+			free( resolveGolden( golden[i].path ) );
+		}
+		for ( unsigned int i = 0; i < kStageCount; ++i )
+		{
+			uint64_t perFile = gStageNanos[i] / count;
+			if ( pass == 0 || perFile < fastest[i] )
+			{
+				fastest[i] = perFile;
+			}
+		}
+	}
+	gTimingStages = 0;
 
-    string template = findParam( kKeywordTemplate );
+	fflush( stdout );
+	fprintf( stderr, "checked %u paths: %u different, %u without an expected output\n",
+	         count, different, added );
 
-    if ( template == NULL)
-    {
-        fprintf( stderr, "### Error: no template found.\n" );
-        result = -2;
-    }
-    else
-    {
-        debugf( 2, "template = \'%s\'\n", template );
+	unsigned int over = 0;
+	if ( count > 0 )
+	{
+		for ( unsigned int i = 0; i < kStageCount; ++i )
+		{
+			fprintf( stderr, "%-10s %8llu ns/file\n", kStageNames[i], (unsigned long long)fastest[i] );
+		}
 
-        string output = buildString( template );
-        string exec   = findParam( kKeywordExecute );
-        if ( exec != NULL)
-        {
-	        result = system( output );
-        }
-        else
-        {
-	        printf( "%s\n", output );
-        }
-        free( (void *)output );
-    }
-    emptyDictionary( gFileDict );
-    return result;
+		string baseline = findParam( kKeywordGoldenBaseline );
+		if ( baseline != NULL )
+		{
+			over = checkStageBudgets( baseline, fastest );
+		}
+	}
+
+	for ( unsigned int i = 0; i < count; ++i )
+	{
+		free( golden[i].path );
+	}
+	free( golden );
+
+	return ( different + over > 0 ) ? 1 : 0;
 }
 
 string usage =
@@ -1149,9 +3936,62 @@ string usage =
 "  -d <string>  set {destination} parameter\n"
 "  -t <string>  set {template} paameter\n"
 "  -x           pass each output string to the shell to execute\n"
+"  -s           skip files whose episode is already in the destination\n"
+"  -l <action>  'report' or 'skip' files already hard-linked into the destination\n"
+"  -b <order>   batch mode: read all inputs first, process them grouped by\n"
+"               directory, and output in 'original' (or 'yes') or 'grouped'\n"
+"               order. 'no' or 'off' turns it off\n"
+"  -p <rule>    in batch mode, only act on one copy of each episode, the\n"
+"               'largest', 'newest', or one whose path starts with <rule>\n"
 "  --           read from stdin\n"
 "  -0           stdin is null-terminated (also implies '--' option)\n"
-"  -v <level>   set the level of verbosity (debug info)\n";
+"  -v <level>   set the level of verbosity (debug info)\n"
+"  --trace <file.json>\n"
+"               record a timeline of each file's processing, in Chrome\n"
+"               trace event format, and write it to <file.json> on exit\n"
+"  --metrics <file.prom>\n"
+"               maintain counters and latency histograms in <file.prom>,\n"
+"               for node_exporter's textfile collector\n"
+"  --checkpoint <file>\n"
+"               record progress in <file>, and if it already exists, resume\n"
+"               after the inputs that were completed by the earlier run\n"
+"  --audit <dir>\n"
+"               check every file in the library <dir> is where it would\n"
+"               have been put, and list the ones that aren't\n"
+"  --json <file>\n"
+"               process the recordings in a Channels DVR JSON export ('-'\n"
+"               for stdin), using its series, season, episode and title\n"
+"  --golden <file>\n"
+"               check the output for each path in <file> is the one given\n"
+"               after it, and time each stage, see --baseline <file> and\n"
+"               --budget <percent>\n";
+
+/* long options, which all take a value and set the parameter of the same name */
+static const struct {
+    string name;
+    tHash  keyword;
+} kLongOptions[] = {
+    { "trace",   kKeywordTrace   },
+    { "metrics", kKeywordMetrics },
+    { "checkpoint", kKeywordCheckpoint },
+    { "audit",   kKeywordAudit   },
+    { "json",    kKeywordJSON    },
+    { "golden",  kKeywordGolden  },
+    { "baseline", kKeywordGoldenBaseline },
+    { "budget",  kKeywordGoldenBudget }
+};
+
+static tHash findLongOption( string name )
+{
+    for ( unsigned int i = 0; i < sizeof(kLongOptions) / sizeof(kLongOptions[0]); ++i )
+    {
+        if ( strcmp( name, kLongOptions[i].name ) == 0 )
+        {
+            return kLongOptions[i].keyword;
+        }
+    }
+    return 0;
+}
 
 
 int main( int argc, string argv[] )
@@ -1162,8 +4002,11 @@ int main( int argc, string argv[] )
 	time_t secsSinceEpoch;
 	struct tm *timeStruct;
 
+    initKeywordSlots();
+
     gMainDict   = createDictionary( "Main" );
-	gSeriesDict = createDictionary( "Series" );
+	gScannedSeries = createDictionary( "Series" );
+	gSeriesDict    = gScannedSeries;
 	gPathDict   = createDictionary( "Path" );
 	gFileDict   = createDictionary( "File" );
 
@@ -1201,6 +4044,7 @@ int main( int argc, string argv[] )
     argc = cnt;
 
     result = parseConfig( configPath );
+    tParam * configured = gMainDict->head;   // anything added ahead of this came from the command line
 
     if ( configPath != NULL )
     {
@@ -1217,7 +4061,14 @@ int main( int argc, string argv[] )
         if (argv[i][0] == '-' )
         {
             char option = argv[i][1];
-            if ( argv[i][2] != '\0' )
+            tHash longOption = ( option == '-' ) ? findLongOption( &argv[i][2] ) : 0;
+            if ( longOption != 0 && i < argc - 1 )
+            {
+                cnt -= 2;
+                ++i;
+                addParam( gMainDict, longOption, argv[ i ] );
+            }
+            else if ( argv[i][2] != '\0' )
             {
                 fprintf( stderr, "### Error: option \'%s\' not understood.\n", argv[ i ] );
                 fprintf( stderr, "%s", usage );
@@ -1248,6 +4099,40 @@ int main( int argc, string argv[] )
                     addParam( gMainDict, kKeywordExecute, "yes" );
                     break;
 
+                case 's':   // skip existing episodes
+                    addParam( gMainDict, kKeywordSkipExisting, "yes" );
+                    break;
+
+                case 'l':   // report or skip files already linked into the destination
+                    if ( i < argc - 1 )
+                    {
+                        ++i;
+                        --cnt;
+
+                        addParam( gMainDict, kKeywordLinked, argv[ i ] );
+                    }
+                    break;
+
+                case 'b':   // batch mode
+                    if ( i < argc - 1 )
+                    {
+                        ++i;
+                        --cnt;
+
+                        addParam( gMainDict, kKeywordBatch, argv[ i ] );
+                    }
+                    break;
+
+                case 'p':   // preferred copy of duplicate episodes
+                    if ( i < argc - 1 )
+                    {
+                        ++i;
+                        --cnt;
+
+                        addParam( gMainDict, kKeywordPrefer, argv[ i ] );
+                    }
+                    break;
+
                 case '-':   // also read lines from stdin
                     addParam( gMainDict, kKeywordStdin, "yes" );
                     break;
@@ -1299,7 +4184,14 @@ int main( int argc, string argv[] )
 	    if ( argv[i][0] == '-' )
 	    {
 		    char option = argv[i][1];
-		    if ( argv[i][2] != '\0' )
+		    tHash longOption = ( option == '-' ) ? findLongOption( &argv[i][2] ) : 0;
+		    if ( longOption != 0 && i < argc - 1 )
+		    {
+			    cnt -= 2;
+			    ++i;
+			    addParam( gMainDict, longOption, argv[i] );
+		    }
+		    else if ( argv[i][2] != '\0' )
 		    {
 			    fprintf( stderr, "### Error: option \'%s\' not understood.\n", argv[i] );
 			    result = -1;
@@ -1326,6 +4218,40 @@ int main( int argc, string argv[] )
 				    addParam( gMainDict, kKeywordExecute, "yes" );
 				    break;
 
+			    case 's':   // skip existing episodes
+				    addParam( gMainDict, kKeywordSkipExisting, "yes" );
+				    break;
+
+			    case 'l':   // report or skip files already linked into the destination
+				    if ( i < argc - 1 )
+				    {
+					    ++i;
+					    --cnt;
+
+					    addParam( gMainDict, kKeywordLinked, argv[i] );
+				    }
+				    break;
+
+			    case 'b':   // batch mode
+				    if ( i < argc - 1 )
+				    {
+					    ++i;
+					    --cnt;
+
+					    addParam( gMainDict, kKeywordBatch, argv[i] );
+				    }
+				    break;
+
+			    case 'p':   // preferred copy of duplicate episodes
+				    if ( i < argc - 1 )
+				    {
+					    ++i;
+					    --cnt;
+
+					    addParam( gMainDict, kKeywordPrefer, argv[i] );
+				    }
+				    break;
+
 			    case '-':   // also read lines from stdin
 				    addParam( gMainDict, kKeywordStdin, "yes" );
 				    break;
@@ -1365,61 +4291,165 @@ int main( int argc, string argv[] )
     }
     argc = cnt;
 
+    gCommandDict = createDictionary( "Command" );
+    copyParams( gCommandDict, gMainDict->head, configured );
+
     printDictionary( gMainDict );
 
+    string trace = findParam( kKeywordTrace );
+    if ( trace != NULL )
+    {
+        traceOpen( trace );
+    }
+
+    string metrics = findParam( kKeywordMetrics );
+    if ( metrics != NULL )
+    {
+        string interval = findParam( kKeywordMetricsInterval );
+        metricsOpen( metrics, interval != NULL ? (unsigned int)atoi( interval ) : 15 );
+    }
+
+    string notifyURL = findParam( kKeywordNotifyURL );
+    if ( notifyURL != NULL && notifyOpen( notifyURL ) != 0 )
+    {
+        result = -1;
+    }
+
+    if ( buildPatterns( gMainDict ) != 0 )
+    {
+        result = -1;
+    }
+
+    string batch = findParam( kKeywordBatch );
+    if ( batch != NULL )
+    {
+        if ( strcasecmp( batch, "grouped" ) == 0 )
+        {
+            gBatchOrder = kBatchGrouped;
+        }
+        else if ( strcasecmp( batch, "original" ) == 0 || strcasecmp( batch, "yes" ) == 0 )
+        {
+            gBatchOrder = kBatchOriginal;
+        }
+        else if ( strcasecmp( batch, "no" ) != 0 && strcasecmp( batch, "off" ) != 0 )
+        {
+            fprintf( stderr, "### Error: batch should be 'original', 'grouped', 'yes', 'no' or 'off', not '%s'.\n", batch );
+            result = -1;
+        }
+    }
+
+    string checkpoint = findParam( kKeywordCheckpoint );
+    if ( checkpoint != NULL && result == 0 )
+    {
+        if ( gBatchOrder != kBatchOff )
+        {
+            fprintf( stderr, "### Error: checkpoints can't be used in batch mode.\n" );
+            result = -1;
+        }
+        else if ( checkpointOpen( checkpoint ) != 0 )
+        {
+            result = -1;
+        }
+    }
+
+    string audit = findParam( kKeywordAudit );
+    if ( audit != NULL && result == 0 )
+    {
+        result = auditLibrary( audit );
+    }
+
+    string json = findParam( kKeywordJSON );
+    if ( json != NULL && result == 0 )
+    {
+        result = importRecordings( json );
+    }
+
+    string golden = findParam( kKeywordGolden );
+    if ( golden != NULL && result == 0 )
+    {
+        result = checkGolden( golden );
+    }
+
     for ( int i = 1; i < argc && result == 0; ++i )
     {
         debugf( 4, "%d: \'%s\'\n", i, argv[ i ] );
-        processFile( argv[i] );
+        processInput( argv[i] );
     }
 
     // should we also read from stdin?
-    if ( findParam( kKeywordStdin ) != NULL )
+    if ( findParam( kKeywordStdin ) != NULL && result == 0 )
     {
-        char line[PATH_MAX];
-
-        if ( findParam( kKeywordNullTermination ) != NULL )
+        // it may be a while, so pick up changes to the config and the destination as we go
+        string reload = findParam( kKeywordReload );
+        unsigned int interval = ( reload != NULL ) ? (unsigned int)atoi( reload ) : 5;
+        if ( interval > 0 && gBatchOrder == kBatchOff )
         {
-            // ...therefore lines are terminated by \0
-            char * p = line;
-            cnt = sizeof( line );
+            watchConfig( interval );
+        }
 
-            while (!feof(stdin))
-            {
-                char c = fgetc( stdin );
-                *p++ = c;
-                cnt--;
+        char line[PATH_MAX];
 
-                if ( c == '\0' || cnt < 1 )
-                {
-                    debugf( 4, "null: %s\n", line );
-                    processFile( line );
+        // entries are terminated by \0 (as from find -print0), otherwise by \n
+        int    nulls = ( findParam( kKeywordNullTermination ) != NULL );
+        size_t consumed;
 
-                    p = line;
-                    cnt = sizeof( line );
-                }
-            }
-        }
-        else
+        while ( ( consumed = readInput( line, sizeof(line), nulls ? '\0' : '\n' ) ) > 0 )
         {
-            while (!feof(stdin))
+            gInputOffset += consumed;
+            if ( !nulls )
             {
-                // ...otherwise lines are terminated by \n
-                fgets( line, sizeof(line), stdin );
-
-                // lop off the inevitable trailing newline(s)/whitespace
+                // lop off any trailing whitespace
                 trimTrailingWhitespace( line );
-                debugf( 4,"eol: %s\n", line);
-                processFile( line);
             }
+            debugf( 4, "%s: %s\n", nulls ? "null" : "eol", line );
+            processInput( line );
         }
     }
 
+    if ( gBatchOrder != kBatchOff )
+    {
+        processBatch();
+    }
+
+    notifyClose();
+    if ( checkpointClose() != 0 )
+    {
+        result = -1;
+    }
+
+    debugf( 1, "config resolutions: %u for %u files\n", gConfigResolutions, gFileCount );
+    debugf( 1, "series cache: %u hits, %u misses\n", gSeriesCacheHits, gSeriesCacheMisses );
+
+    // stop the watcher first, as a rebuild may still be tracing or logging
+	if ( gSnapshot != NULL )
+	{
+		snapshotClose();   // gMainDict belongs to the snapshot
+	}
+	else
+	{
+		destroyDictionary( gMainDict );
+	}
+
+    traceClose();
+    metricsClose();
+
     // all done, clean up.
 	destroyDictionary( gFileDict );
 	destroyDictionary( gPathDict );
-	destroyDictionary( gSeriesDict );
-	destroyDictionary( gMainDict );
+	destroyDictionary( gScannedSeries );
+	releaseSeriesSegments();
+	destroyDictionary( gCommandDict );
+	for ( unsigned int i = 0; i < kConfigFiles; ++i )
+	{
+		free( (void *)gConfigFiles[i] );
+	}
+	releaseConfigCache();
+	releasePatterns();
+	releaseEpisodeIndex();
+	releaseInodeIndexes();
+	releaseGuides();
+	releaseFingerprints();
+	free( gContext.overflow );
 
     return result;
 }
@@ -11,7 +11,14 @@
 
 typedef const char * string;
 
+#include "log.h"
+
+/* debug levels above this are compiled out entirely (set with -DDEBUG_MAX_LEVEL=n) */
+#ifndef DEBUG_MAX_LEVEL
+#define DEBUG_MAX_LEVEL 4
+#endif
+
 extern int gDebugLevel;
-#define debugf( level, format, ... ) do { if (gDebugLevel >= level) fprintf( stderr, format, __VA_ARGS__ ); } while (0)
+#define debugf( level, format, ... ) do { if ( (level) <= DEBUG_MAX_LEVEL && gDebugLevel >= (level) ) logPrintf( format, __VA_ARGS__ ); } while (0)
 
 #endif // DVR2PLEX_H
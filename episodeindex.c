@@ -0,0 +1,264 @@
+//
+// Created by paul on 10/19/26.
+//
+// The set of episodes already present in the destination, keyed by
+// (series folder, season, episode). The series folder is identified by a
+// hash of its full path, so the same show under two different destinations
+// is kept apart. Folders are only scanned when first needed. Each folder
+// that has been scanned is recorded in a second table, along with a stamp
+// of the modification times of the directories that were read, so that a
+// folder that changes later (e.g. an episode is deleted to be replaced) is
+// forgotten and scanned again.
+//
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+
+#include "dictionary.h"
+#include "episodeindex.h"
+
+typedef struct {
+    tHash    folder;
+    uint32_t episode;   // season << 16 | episode
+    uint32_t used;
+} tEpisodeEntry;
+
+typedef struct {
+    tHash    folder;
+    uint64_t stamp;     // of the folder when it was scanned
+    uint32_t used;
+} tFolderEntry;
+
+static tEpisodeEntry * gEpisodes     = NULL;
+static size_t          gEpisodeCount = 0;
+static size_t          gEpisodeSize  = 0;   // always a power of two
+
+static tFolderEntry  * gFolders      = NULL;
+static size_t          gFolderCount  = 0;
+static size_t          gFolderSize   = 0;   // always a power of two
+
+static size_t episodeSlot( tHash folder, uint32_t episode )
+{
+    uint64_t h = (uint64_t)folder ^ ( (uint64_t)episode * 0x9E3779B97F4A7C15ULL );
+    h ^= h >> 29;
+    return (size_t)h & ( gEpisodeSize - 1 );
+}
+
+static tEpisodeEntry * findEntry( tHash folder, uint32_t episode )
+{
+    if ( gEpisodeSize == 0 )
+    {
+        return NULL;
+    }
+    for ( size_t slot = episodeSlot( folder, episode ); gEpisodes[ slot ].used; slot = (slot + 1) & (gEpisodeSize - 1) )
+    {
+        tEpisodeEntry * entry = &gEpisodes[ slot ];
+        if ( entry->folder == folder && entry->episode == episode )
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void insertEntry( tHash folder, uint32_t episode )
+{
+    if ( findEntry( folder, episode ) != NULL )
+    {
+        return;
+    }
+
+    // keep the table no more than half full
+    if ( (gEpisodeCount + 1) * 2 > gEpisodeSize )
+    {
+        tEpisodeEntry * old  = gEpisodes;
+        size_t          size = gEpisodeSize;
+
+        gEpisodeSize = ( size == 0 ) ? 1024 : size * 2;
+        gEpisodes    = calloc( gEpisodeSize, sizeof(tEpisodeEntry) );
+        if ( gEpisodes == NULL )
+        {
+            fprintf( stderr, "### Error: unable to allocate memory for episode index (%d: %s)\n",
+                     errno, strerror(errno) );
+            gEpisodes    = old;
+            gEpisodeSize = size;
+            return;
+        }
+        for ( size_t i = 0; i < size; ++i )
+        {
+            if ( old[i].used )
+            {
+                size_t slot = episodeSlot( old[i].folder, old[i].episode );
+                while ( gEpisodes[ slot ].used )
+                {
+                    slot = (slot + 1) & (gEpisodeSize - 1);
+                }
+                gEpisodes[ slot ] = old[i];
+            }
+        }
+        free( old );
+    }
+
+    size_t slot = episodeSlot( folder, episode );
+    while ( gEpisodes[ slot ].used )
+    {
+        slot = (slot + 1) & (gEpisodeSize - 1);
+    }
+    gEpisodes[ slot ].folder  = folder;
+    gEpisodes[ slot ].episode = episode;
+    gEpisodes[ slot ].used    = 1;
+    ++gEpisodeCount;
+}
+
+static size_t folderSlot( tHash folder )
+{
+    uint64_t h = (uint64_t)folder * 0x9E3779B97F4A7C15ULL;
+    return (size_t)( h >> 29 ) & ( gFolderSize - 1 );
+}
+
+static tFolderEntry * findFolder( tHash folder )
+{
+    if ( gFolderSize == 0 )
+    {
+        return NULL;
+    }
+    for ( size_t slot = folderSlot( folder ); gFolders[ slot ].used; slot = (slot + 1) & (gFolderSize - 1) )
+    {
+        if ( gFolders[ slot ].folder == folder )
+        {
+            return &gFolders[ slot ];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief drop the episodes found in 'folder', by rebuilding the table without them
+ */
+static void forgetEpisodes( tHash folder )
+{
+    tEpisodeEntry * old  = gEpisodes;
+    size_t          size = gEpisodeSize;
+
+    gEpisodes     = calloc( size, sizeof(tEpisodeEntry) );
+    gEpisodeCount = 0;
+    if ( gEpisodes == NULL )
+    {
+        // start again from nothing, and every folder will be scanned again
+        free( old );
+        gEpisodeSize = 0;
+        gFolderCount = 0;
+        memset( gFolders, 0, gFolderSize * sizeof(tFolderEntry) );
+        return;
+    }
+    for ( size_t i = 0; i < size; ++i )
+    {
+        if ( old[i].used && old[i].folder != folder )
+        {
+            size_t slot = episodeSlot( old[i].folder, old[i].episode );
+            while ( gEpisodes[ slot ].used )
+            {
+                slot = (slot + 1) & (gEpisodeSize - 1);
+            }
+            gEpisodes[ slot ] = old[i];
+            ++gEpisodeCount;
+        }
+    }
+    free( old );
+}
+
+/**
+ * @return non-zero if 'folder' has been scanned, and hasn't changed since. If it has changed,
+ *         what was found in it is forgotten, to be scanned again
+ */
+int isFolderIndexed( tHash folder, uint64_t stamp )
+{
+    tFolderEntry * entry = findFolder( folder );
+
+    if ( entry == NULL )
+    {
+        return 0;
+    }
+    if ( entry->stamp != stamp )
+    {
+        forgetEpisodes( folder );   // markFolderIndexed() updates the stamp, once it's scanned
+        return 0;
+    }
+    return 1;
+}
+
+void markFolderIndexed( tHash folder, uint64_t stamp )
+{
+    tFolderEntry * entry = findFolder( folder );
+    if ( entry != NULL )
+    {
+        entry->stamp = stamp;
+        return;
+    }
+
+    if ( (gFolderCount + 1) * 2 > gFolderSize )
+    {
+        tFolderEntry * old  = gFolders;
+        size_t         size = gFolderSize;
+
+        gFolderSize = ( size == 0 ) ? 256 : size * 2;
+        gFolders    = calloc( gFolderSize, sizeof(tFolderEntry) );
+        if ( gFolders == NULL )
+        {
+            fprintf( stderr, "### Error: unable to allocate memory for episode index (%d: %s)\n",
+                     errno, strerror(errno) );
+            gFolders    = old;
+            gFolderSize = size;
+            return;
+        }
+        for ( size_t i = 0; i < size; ++i )
+        {
+            if ( old[i].used )
+            {
+                size_t slot = folderSlot( old[i].folder );
+                while ( gFolders[ slot ].used )
+                {
+                    slot = (slot + 1) & (gFolderSize - 1);
+                }
+                gFolders[ slot ] = old[i];
+            }
+        }
+        free( old );
+    }
+
+    size_t slot = folderSlot( folder );
+    while ( gFolders[ slot ].used )
+    {
+        slot = (slot + 1) & (gFolderSize - 1);
+    }
+    gFolders[ slot ].folder = folder;
+    gFolders[ slot ].stamp  = stamp;
+    gFolders[ slot ].used   = 1;
+    ++gFolderCount;
+}
+
+void addEpisode( tHash folder, unsigned int season, unsigned int episode )
+{
+    insertEntry( folder, (season & 0xFFFF) << 16 | (episode & 0xFFFF) );
+}
+
+int findEpisode( tHash folder, unsigned int season, unsigned int episode )
+{
+    return findEntry( folder, (season & 0xFFFF) << 16 | (episode & 0xFFFF) ) != NULL;
+}
+
+void releaseEpisodeIndex( void )
+{
+    free( gEpisodes );
+    gEpisodes     = NULL;
+    gEpisodeCount = 0;
+    gEpisodeSize  = 0;
+
+    free( gFolders );
+    gFolders      = NULL;
+    gFolderCount  = 0;
+    gFolderSize   = 0;
+}
@@ -0,0 +1,14 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_EPISODEINDEX_H
+#define DVR2PLEX_EPISODEINDEX_H
+
+int  isFolderIndexed( tHash folder, uint64_t stamp );
+void markFolderIndexed( tHash folder, uint64_t stamp );
+void addEpisode( tHash folder, unsigned int season, unsigned int episode );
+int  findEpisode( tHash folder, unsigned int season, unsigned int episode );
+void releaseEpisodeIndex( void );
+
+#endif // DVR2PLEX_EPISODEINDEX_H
@@ -0,0 +1,213 @@
+//
+// Created by paul on 10/19/26.
+//
+// A fingerprint of a file's content, cheap enough to use on multi-gigabyte
+// recordings. Rather than reading the whole file, a handful of fixed-size
+// samples are read: the head, the tail, and several evenly spaced through
+// the middle. Along with the file size, that's plenty to tell whether two
+// recordings are the same, which is all it's for.
+//
+// The samples are hashed four 64-bit lanes at a time, in a layout the
+// compiler can vectorise, and the lanes are combined into a 128-bit result
+// at the end. Fingerprints are remembered by (device, inode, mtime), so a
+// file is only sampled once per run however often it's asked about.
+//
+#define _XOPEN_SOURCE 700
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fingerprint.h"
+
+#define kSampleSize     (64 * 1024)
+#define kSampleCount    8            // head + tail + 6 from the middle
+#define kLanes          4
+
+#define kPrime1 0x9E3779B185EBCA87ULL
+#define kPrime2 0xC2B2AE3D27D4EB4FULL
+#define kPrime3 0x165667B19E3779F9ULL
+
+typedef struct sFingerprintCache {
+    struct sFingerprintCache * next;
+    dev_t        device;
+    ino_t        inode;
+    struct timespec mtime;
+    tFingerprint fingerprint;
+} tFingerprintCache;
+
+#define kFingerprintCacheSize 64
+static tFingerprintCache * gFingerprints[ kFingerprintCacheSize ];
+
+static inline uint64_t rotl64( uint64_t x, int r )
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t avalanche( uint64_t h )
+{
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * @brief fold a buffer into the lanes. length must be a multiple of kLanes * 8
+ */
+static void hashStripes( uint64_t lane[ kLanes ], const unsigned char * data, size_t length )
+{
+    uint64_t word[ kLanes ];
+
+    for ( size_t offset = 0; offset < length; offset += sizeof(word) )
+    {
+        memcpy( word, data + offset, sizeof(word) );
+        for ( int i = 0; i < kLanes; ++i )
+        {
+            lane[i] = rotl64( lane[i] + word[i] * kPrime2, 31 ) * kPrime1;
+        }
+    }
+}
+
+/**
+ * @return 0 on success, otherwise the errno from reading it
+ */
+static int hashSample( int fd, uint64_t lane[ kLanes ], unsigned char * buffer, off_t offset, size_t length )
+{
+    ssize_t count = pread( fd, buffer, length, offset );
+    if ( count < 0 )
+    {
+        return ( errno != 0 ) ? errno : EIO;
+    }
+
+    // pad the last partial stripe with zeros; the file size is hashed separately
+    size_t stripe = kLanes * sizeof(uint64_t);
+    size_t padded = ( (size_t)count + stripe - 1 ) / stripe * stripe;
+    memset( buffer + count, 0, padded - count );
+
+    hashStripes( lane, buffer, padded );
+    return 0;
+}
+
+static tFingerprintCache ** cacheSlot( const struct stat * fileStat )
+{
+    return &gFingerprints[ ( fileStat->st_ino ^ fileStat->st_dev ) % kFingerprintCacheSize ];
+}
+
+/**
+ * @brief generate the fingerprint of a file's content
+ * @return 0 on success, otherwise an errno
+ */
+int fingerprintFile( string path, tFingerprint * fingerprint )
+{
+    struct stat fileStat;
+    int result = 0;
+
+    int fd = open( path, O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 || fstat( fd, &fileStat ) != 0 )
+    {
+        result = errno;
+        fprintf( stderr, "### Error: Unable to fingerprint \'%s\' (%d: %s)\n",
+                 path, errno, strerror(errno) );
+        if ( fd >= 0 )
+        {
+            close( fd );
+        }
+        return result;
+    }
+
+    for ( tFingerprintCache * cached = *cacheSlot( &fileStat ); cached != NULL; cached = cached->next )
+    {
+        if ( cached->device == fileStat.st_dev && cached->inode == fileStat.st_ino
+          && cached->mtime.tv_sec  == fileStat.st_mtim.tv_sec
+          && cached->mtime.tv_nsec == fileStat.st_mtim.tv_nsec )
+        {
+            *fingerprint = cached->fingerprint;
+            close( fd );
+            return 0;
+        }
+    }
+
+    unsigned char * buffer = malloc( kSampleSize + kLanes * sizeof(uint64_t) );
+    if ( buffer == NULL )
+    {
+        close( fd );
+        return ENOMEM;
+    }
+
+    uint64_t lane[ kLanes ] = {
+        kPrime1 + kPrime2, kPrime2, 0, -kPrime1
+    };
+    off_t size = fileStat.st_size;
+
+    if ( size <= (off_t)kSampleSize * kSampleCount )
+    {
+        // small enough to just read the whole thing
+        for ( off_t offset = 0; offset < size && result == 0; offset += kSampleSize )
+        {
+            result = hashSample( fd, lane, buffer, offset, kSampleSize );
+        }
+    }
+    else
+    {
+        off_t step = ( size - kSampleSize ) / ( kSampleCount - 1 );
+        for ( int i = 0; i < kSampleCount && result == 0; ++i )
+        {
+            off_t offset = ( i == kSampleCount - 1 ) ? size - kSampleSize : i * step;
+            result = hashSample( fd, lane, buffer, offset, kSampleSize );
+        }
+    }
+    close( fd );
+    free( buffer );
+
+    if ( result != 0 )
+    {
+        fprintf( stderr, "### Error: Unable to read \'%s\' (%d: %s)\n",
+                 path, result, strerror(result) );
+        return result;
+    }
+
+    uint64_t h1 = rotl64( lane[0], 1 ) + rotl64( lane[1], 7 ) + (uint64_t)size;
+    uint64_t h2 = ( rotl64( lane[2], 12 ) + rotl64( lane[3], 18 ) ) ^ ( (uint64_t)size * kPrime3 );
+    fingerprint->high = avalanche( h1 ^ rotl64( h2, 27 ) );
+    fingerprint->low  = avalanche( h2 + h1 * kPrime1 );
+
+    tFingerprintCache * cached = malloc( sizeof(tFingerprintCache) );
+    if ( cached != NULL )
+    {
+        tFingerprintCache ** slot = cacheSlot( &fileStat );
+        cached->device      = fileStat.st_dev;
+        cached->inode       = fileStat.st_ino;
+        cached->mtime       = fileStat.st_mtim;
+        cached->fingerprint = *fingerprint;
+        cached->next        = *slot;
+        *slot = cached;
+    }
+    return 0;
+}
+
+void formatFingerprint( const tFingerprint * fingerprint, char buffer[ kFingerprintLength + 1 ] )
+{
+    snprintf( buffer, kFingerprintLength + 1, "%016llx%016llx",
+              (unsigned long long)fingerprint->high, (unsigned long long)fingerprint->low );
+}
+
+void releaseFingerprints( void )
+{
+    for ( int i = 0; i < kFingerprintCacheSize; ++i )
+    {
+        while ( gFingerprints[i] != NULL )
+        {
+            tFingerprintCache * next = gFingerprints[i]->next;
+            free( gFingerprints[i] );
+            gFingerprints[i] = next;
+        }
+    }
+}
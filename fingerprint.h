@@ -0,0 +1,21 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_FINGERPRINT_H
+#define DVR2PLEX_FINGERPRINT_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint64_t high;
+    uint64_t low;
+} tFingerprint;
+
+#define kFingerprintLength 32   // in hex digits, not including the terminating NUL
+
+int  fingerprintFile( string path, tFingerprint * fingerprint );
+void formatFingerprint( const tFingerprint * fingerprint, char buffer[ kFingerprintLength + 1 ] );
+void releaseFingerprints( void );
+
+#endif // DVR2PLEX_FINGERPRINT_H
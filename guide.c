@@ -0,0 +1,565 @@
+//
+// Created by paul on 10/19/26.
+//
+// Episode guides for shows that are only identified by the date they aired,
+// e.g. talk shows and the news. A guide is a CSV or TSV file, one episode per
+// line: series, air date, season, episode and (optionally) title. It is
+// compiled into a hash table keyed by (series, air date), where the series
+// is hashed by the caller the same way series folder names are, so that
+// 'The Daily Show' in the guide matches 'the.daily.show' in a filename.
+//
+// The table and the titles it refers to are laid out so they can be written
+// to a file as-is. If a cache directory is configured, the compiled guide is
+// saved there, and later runs map it straight back in, for as long as the
+// guide file has the same inode, size and modification time. A guide that
+// changes while running is noticed within kGuideRecheck seconds, and then
+// compiled again.
+//
+#define _XOPEN_SOURCE 700
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "guide.h"
+
+#define kGuideMagic     0x47503244  // 'D2PG'
+#define kGuideVersion   1
+#define kGuideRecheck   5           // seconds
+#define kGuideFields    5           // series, date, season, episode, title
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t  mtimeSec;
+    int64_t  mtimeNsec;
+    uint32_t tableSize;  // number of tGuideEntry slots, a power of two
+    uint32_t count;      // number of episodes
+    uint32_t poolSize;   // size of the title pool that follows the table
+    uint32_t reserved;
+} tGuideHeader;
+
+typedef struct {
+    uint64_t series;     // hash of the series name, or 0 if the slot is unused
+    uint32_t date;       // YYYYMMDD
+    uint16_t season;
+    uint16_t episode;
+    uint32_t title;      // offset in the pool, 0 if there isn't one
+    uint32_t reserved;
+} tGuideEntry;
+
+typedef struct sGuide {
+    struct sGuide * next;
+    string        path;
+    time_t        checked;   // when the guide file was last stat'ed
+
+    tGuideHeader  header;
+    tGuideEntry * table;
+    char        * pool;
+    uint32_t      poolUsed;
+
+    void        * mapping;   // if loaded from the cache, the table and pool point into this
+    size_t        mappingLength;
+} tGuide;
+
+static tGuide * gGuides = NULL;
+
+static size_t guideSlot( const tGuide * guide, uint64_t series, uint32_t date )
+{
+    uint64_t h = ( series ^ date ) * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 32) & ( guide->header.tableSize - 1 );
+}
+
+/**
+ * @brief convert a date in the form YYYY-MM-DD (or YYYYMMDD, YYYY/MM/DD) to YYYYMMDD
+ * @return the date, or 0 if it isn't one
+ */
+unsigned int guideDate( string date )
+{
+    unsigned int result = 0;
+    unsigned int digits = 0;
+
+    for ( string p = date; *p != '\0' && *p != ' '; p++ )
+    {
+        if ( *p >= '0' && *p <= '9' )
+        {
+            result = result * 10 + ( *p - '0' );
+            ++digits;
+        }
+        else if ( *p != '-' && *p != '/' )
+        {
+            return 0;
+        }
+    }
+    if ( digits != 8 )
+    {
+        return 0;
+    }
+
+    unsigned int month = ( result / 100 ) % 100;
+    unsigned int day   = result % 100;
+    return ( month >= 1 && month <= 12 && day >= 1 && day <= 31 ) ? result : 0;
+}
+
+static uint32_t addTitle( tGuide * guide, string title, uint32_t * poolSize )
+{
+    size_t length = strlen( title ) + 1;
+
+    if ( length == 1 )
+    {
+        return 0;
+    }
+    if ( guide->poolUsed + length > *poolSize )
+    {
+        uint32_t size = *poolSize;
+        while ( guide->poolUsed + length > size )
+        {
+            size *= 2;
+        }
+        char * pool = realloc( guide->pool, size );
+        if ( pool == NULL )
+        {
+            return 0;
+        }
+        guide->pool = pool;
+        *poolSize   = size;
+    }
+    uint32_t offset = guide->poolUsed;
+    memcpy( &guide->pool[ offset ], title, length );
+    guide->poolUsed += length;
+    return offset;
+}
+
+static void insertEpisode( tGuide * guide, const tGuideEntry * episode )
+{
+    if ( ( guide->header.count + 1 ) * 2 > guide->header.tableSize )
+    {
+        tGuideEntry * old  = guide->table;
+        uint32_t      size = guide->header.tableSize;
+
+        guide->header.tableSize = ( size == 0 ) ? 1024 : size * 2;
+        guide->table = calloc( guide->header.tableSize, sizeof(tGuideEntry) );
+        if ( guide->table == NULL )
+        {
+            guide->table = old;
+            guide->header.tableSize = size;
+            return;
+        }
+        guide->header.count = 0;
+        for ( uint32_t i = 0; i < size; ++i )
+        {
+            if ( old[i].series != 0 )
+            {
+                insertEpisode( guide, &old[i] );
+            }
+        }
+        free( old );
+    }
+
+    size_t slot = guideSlot( guide, episode->series, episode->date );
+    while ( guide->table[ slot ].series != 0 )
+    {
+        if ( guide->table[ slot ].series == episode->series && guide->table[ slot ].date == episode->date )
+        {
+            return;   // more than one episode that day, so the first one listed wins
+        }
+        slot = (slot + 1) & (guide->header.tableSize - 1);
+    }
+    guide->table[ slot ] = *episode;
+    ++guide->header.count;
+}
+
+/**
+ * @brief split a line of the guide into its fields, in place. A CSV field may be
+ *        quoted, with any quotes inside it doubled
+ * @return the number of fields
+ */
+static unsigned int splitGuideLine( char * line, string * field )
+{
+    char         delimiter = ( strchr( line, '\t' ) != NULL ) ? '\t' : ',';
+    unsigned int count = 0;
+    char       * s = line;
+
+    while ( count < kGuideFields )
+    {
+        char * d = s;
+        field[ count++ ] = s;
+
+        if ( *s == '"' && delimiter == ',' )
+        {
+            for ( s++; *s != '\0'; s++ )
+            {
+                if ( *s == '"' )
+                {
+                    if ( s[1] != '"' )
+                    {
+                        s++;
+                        break;
+                    }
+                    s++;
+                }
+                *d++ = *s;
+            }
+        }
+        while ( *s != '\0' && *s != delimiter )
+        {
+            *d++ = *s++;
+        }
+
+        int last = ( *s == '\0' );
+        *d = '\0';
+        if ( last )
+        {
+            break;
+        }
+        s++;
+    }
+    return count;
+}
+
+static int compileGuide( tGuide * guide, FILE * file, tGuideSeriesHash hashSeries )
+{
+    char       * line     = NULL;
+    size_t       length   = 0;
+    uint32_t     poolSize = 65536;
+    unsigned int skipped  = 0;
+    ssize_t      read;
+
+    guide->pool = malloc( poolSize );
+    if ( guide->pool == NULL )
+    {
+        return -ENOMEM;
+    }
+    guide->pool[0]  = '\0';     // so offset 0 can mean 'no title'
+    guide->poolUsed = 1;
+
+    while ( ( read = getline( &line, &length, file ) ) >= 0 )
+    {
+        string field[ kGuideFields ];
+
+        while ( read > 0 && ( line[ read - 1 ] == '\n' || line[ read - 1 ] == '\r' ) )
+        {
+            line[ --read ] = '\0';
+        }
+
+        unsigned int count = splitGuideLine( line, field );
+        tGuideEntry  episode;
+
+        memset( &episode, 0, sizeof(episode) );
+        episode.date = ( count >= 4 ) ? guideDate( field[1] ) : 0;
+        if ( episode.date == 0 || field[0][0] == '\0' )
+        {
+            ++skipped;  // e.g. the header row
+            continue;
+        }
+        episode.series  = hashSeries( field[0] );
+        episode.season  = (uint16_t)atoi( field[2] );
+        episode.episode = (uint16_t)atoi( field[3] );
+        episode.title   = ( count >= 5 ) ? addTitle( guide, field[4], &poolSize ) : 0;
+        if ( episode.series == 0 )
+        {
+            episode.series = 1;     // 0 marks an unused slot
+        }
+        insertEpisode( guide, &episode );
+    }
+    free( line );
+
+    debugf( 2, "compiled guide \'%s\', %u episodes, %u lines skipped\n",
+            guide->path, guide->header.count, skipped );
+    return 0;
+}
+
+static void cacheFileName( char * buffer, size_t size, string cacheDir, string path )
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for ( const unsigned char * p = (const unsigned char *)path; *p != '\0'; p++ )
+    {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+    snprintf( buffer, size, "%s/%016llx.guide.cache", cacheDir, (unsigned long long)hash );
+}
+
+static void setGuideStat( tGuideHeader * header, const struct stat * fileStat )
+{
+    header->device    = fileStat->st_dev;
+    header->inode     = fileStat->st_ino;
+    header->size      = fileStat->st_size;
+    header->mtimeSec  = fileStat->st_mtim.tv_sec;
+    header->mtimeNsec = fileStat->st_mtim.tv_nsec;
+}
+
+static int isFresh( const tGuideHeader * header, const struct stat * fileStat )
+{
+    return header->magic     == kGuideMagic
+        && header->version   == kGuideVersion
+        && header->device    == (uint64_t)fileStat->st_dev
+        && header->inode     == (uint64_t)fileStat->st_ino
+        && header->size      == (uint64_t)fileStat->st_size
+        && header->mtimeSec  == (int64_t)fileStat->st_mtim.tv_sec
+        && header->mtimeNsec == (int64_t)fileStat->st_mtim.tv_nsec;
+}
+
+/**
+ * @brief map in a compiled guide, if the guide file hasn't changed since
+ */
+static int loadGuide( tGuide * guide, string cacheDir, const struct stat * fileStat )
+{
+    char        cacheFile[ PATH_MAX ];
+    struct stat cacheStat;
+
+    cacheFileName( cacheFile, sizeof(cacheFile), cacheDir, guide->path );
+
+    int fd = open( cacheFile, O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 )
+    {
+        return -1;
+    }
+
+    void * base = MAP_FAILED;
+    if ( fstat( fd, &cacheStat ) == 0 && (size_t)cacheStat.st_size >= sizeof(tGuideHeader) )
+    {
+        base = mmap( NULL, cacheStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    }
+    close( fd );
+
+    if ( base == MAP_FAILED )
+    {
+        return -1;
+    }
+
+    const tGuideHeader * header = base;
+    size_t expected = sizeof(tGuideHeader)
+                    + (size_t)header->tableSize * sizeof(tGuideEntry)
+                    + header->poolSize;
+
+    tGuideEntry * table = (tGuideEntry *)(header + 1);
+    char        * pool  = (char *)(table + header->tableSize);
+
+    int fresh = isFresh( header, fileStat ) && expected == (size_t)cacheStat.st_size
+             && header->tableSize != 0 && ( header->tableSize & (header->tableSize - 1) ) == 0
+             && header->count < header->tableSize
+             && header->poolSize != 0 && pool[ header->poolSize - 1 ] == '\0';
+
+    // every title has to be in the pool, and the count right, so a lookup always reaches an unused slot
+    uint32_t used = 0;
+    for ( uint32_t i = 0; fresh && i < header->tableSize; ++i )
+    {
+        if ( table[i].series != 0 )
+        {
+            fresh = table[i].title < header->poolSize;
+            ++used;
+        }
+    }
+
+    if ( !fresh || used != header->count )
+    {
+        debugf( 3, "stale guide: \'%s\'\n", cacheFile );
+        munmap( base, cacheStat.st_size );
+        return -1;
+    }
+
+    guide->header        = *header;
+    guide->mapping       = base;
+    guide->mappingLength = cacheStat.st_size;
+    guide->table         = table;
+    guide->pool          = pool;
+    guide->poolUsed      = header->poolSize;
+
+    debugf( 2, "mapped guide: \'%s\', %u episodes\n", cacheFile, guide->header.count );
+    return 0;
+}
+
+static int saveGuide( tGuide * guide, string cacheDir )
+{
+    char cacheFile[ PATH_MAX ];
+    char tempFile[ PATH_MAX + 16 ];
+
+    mkdir( cacheDir, 0755 );   // in case it doesn't exist yet
+    cacheFileName( cacheFile, sizeof(cacheFile), cacheDir, guide->path );
+    snprintf( tempFile, sizeof(tempFile), "%s.%d", cacheFile, (int)getpid() );
+
+    FILE * file = fopen( tempFile, "w" );
+    if ( file == NULL )
+    {
+        fprintf( stderr, "### Error: Unable to create guide cache \'%s\' (%d: %s)\n",
+                 tempFile, errno, strerror(errno) );
+        return errno;
+    }
+
+    guide->header.poolSize = guide->poolUsed;
+
+    int ok = fwrite( &guide->header, sizeof(tGuideHeader), 1, file ) == 1
+          && fwrite( guide->table, sizeof(tGuideEntry), guide->header.tableSize, file ) == guide->header.tableSize
+          && fwrite( guide->pool, 1, guide->poolUsed, file ) == guide->poolUsed;
+
+    if ( fclose( file ) != 0 || !ok || rename( tempFile, cacheFile ) != 0 )
+    {
+        fprintf( stderr, "### Error: Unable to write guide cache \'%s\' (%d: %s)\n",
+                 cacheFile, errno, strerror(errno) );
+        remove( tempFile );
+        return -1;
+    }
+    return 0;
+}
+
+static void emptyGuide( tGuide * guide )
+{
+    if ( guide->mapping != NULL )
+    {
+        munmap( guide->mapping, guide->mappingLength );
+    }
+    else
+    {
+        free( guide->table );
+        free( guide->pool );
+    }
+    guide->mapping  = NULL;
+    guide->table    = NULL;
+    guide->pool     = NULL;
+    guide->poolUsed = 0;
+    memset( &guide->header, 0, sizeof(guide->header) );
+}
+
+/**
+ * @brief (re)build a guide from the guide file, or from the cache if it's fresh
+ */
+static void openGuide( tGuide * guide, string cacheDir, tGuideSeriesHash hashSeries, const struct stat * fileStat )
+{
+    emptyGuide( guide );
+
+    if ( cacheDir != NULL && loadGuide( guide, cacheDir, fileStat ) == 0 )
+    {
+        return;
+    }
+
+    FILE * file = fopen( guide->path, "r" );
+    if ( file == NULL )
+    {
+        fprintf( stderr, "### Error: Unable to open guide \'%s\' (%d: %s)\n",
+                 guide->path, errno, strerror(errno) );
+        return;
+    }
+    guide->header.magic   = kGuideMagic;
+    guide->header.version = kGuideVersion;
+    setGuideStat( &guide->header, fileStat );
+    int result = compileGuide( guide, file, hashSeries );
+    fclose( file );
+
+    if ( result == 0 && cacheDir != NULL && guide->header.tableSize > 0 )
+    {
+        saveGuide( guide, cacheDir );
+    }
+}
+
+static tGuide * getGuide( string path, string cacheDir, tGuideSeriesHash hashSeries )
+{
+    tGuide    * guide;
+    struct stat fileStat;
+    time_t      now     = time( NULL );
+    int         created = 0;
+
+    for ( guide = gGuides; guide != NULL; guide = guide->next )
+    {
+        if ( strcmp( guide->path, path ) == 0 )
+        {
+            break;
+        }
+    }
+
+    if ( guide != NULL && now - guide->checked < kGuideRecheck )
+    {
+        return guide;
+    }
+
+    if ( guide == NULL )
+    {
+        guide = calloc( 1, sizeof(tGuide) );
+        if ( guide == NULL )
+        {
+            return NULL;
+        }
+        guide->path = strdup( path );
+        guide->next = gGuides;
+        gGuides = guide;
+        created = 1;
+    }
+    guide->checked = now;
+
+    if ( stat( path, &fileStat ) != 0 )
+    {
+        // only complain when it first goes missing
+        if ( created || guide->header.magic != 0 )
+        {
+            fprintf( stderr, "### Error: Unable to open guide \'%s\' (%d: %s)\n",
+                     path, errno, strerror(errno) );
+        }
+        emptyGuide( guide );
+    }
+    else if ( !isFresh( &guide->header, &fileStat ) )
+    {
+        openGuide( guide, cacheDir, hashSeries, &fileStat );
+    }
+    return guide;
+}
+
+/**
+ * @brief find the episode of 'series' that aired on 'date' (YYYYMMDD) in the guide file 'guide'
+ * @param hashSeries how to hash the series names in the guide, the same way 'series' was
+ * @param title set to the episode title, or NULL if the guide doesn't have one. It remains
+ *              valid until the guide file changes
+ * @return 0 if it was found
+ */
+int findGuideEpisode( string guide, string cacheDir, tGuideSeriesHash hashSeries,
+                      tHash series, unsigned int date,
+                      unsigned int * season, unsigned int * episode, string * title )
+{
+    tGuide * index = getGuide( guide, cacheDir, hashSeries );
+
+    if ( index == NULL || index->header.tableSize == 0 )
+    {
+        return -1;
+    }
+    if ( series == 0 )
+    {
+        series = 1;
+    }
+
+    for ( size_t slot = guideSlot( index, series, date ); index->table[ slot ].series != 0;
+          slot = (slot + 1) & (index->header.tableSize - 1) )
+    {
+        const tGuideEntry * entry = &index->table[ slot ];
+        if ( entry->series == series && entry->date == date )
+        {
+            *season  = entry->season;
+            *episode = entry->episode;
+            *title   = ( entry->title != 0 ) ? &index->pool[ entry->title ] : NULL;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void releaseGuides( void )
+{
+    while ( gGuides != NULL )
+    {
+        tGuide * next = gGuides->next;
+        emptyGuide( gGuides );
+        free( (void *)gGuides->path );
+        free( gGuides );
+        gGuides = next;
+    }
+}
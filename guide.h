@@ -0,0 +1,19 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_GUIDE_H
+#define DVR2PLEX_GUIDE_H
+
+#include "dictionary.h"
+
+/* the hash of a series name, as it should be matched against the guide */
+typedef tHash (* tGuideSeriesHash)( string series );
+
+unsigned int guideDate( string date );
+         int findGuideEpisode( string guide, string cacheDir, tGuideSeriesHash hashSeries,
+                               tHash series, unsigned int date,
+                               unsigned int * season, unsigned int * episode, string * title );
+        void releaseGuides( void );
+
+#endif // DVR2PLEX_GUIDE_H
@@ -0,0 +1,432 @@
+//
+// Created by paul on 10/19/26.
+//
+// An index of the files in a destination library that have more than one
+// link, keyed by (device, inode). A source file with more than one link
+// can then be looked up to see if it's already linked into the library,
+// without a 'find -samefile' over the whole tree.
+//
+// The index for each destination root is built by a parallel walk of the
+// tree the first time it is needed. If a cache directory is configured, it
+// is also saved there, along with the modification time of every directory
+// in the library. On the next run, those directories are stat'ed, and if
+// none of them has changed, the saved index is mapped in and used as-is.
+// Any change means the whole index is rebuilt.
+//
+#define _XOPEN_SOURCE 700
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "walk.h"
+#include "inodeindex.h"
+
+#define kInodeIndexMagic   0x49503244  // 'D2PI'
+#define kInodeIndexVersion 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dirCount;
+    uint32_t tableSize;  // number of tInodeEntry slots, a power of two
+    uint32_t fileCount;
+    uint32_t poolSize;
+} tInodeIndexHeader;
+
+typedef struct {
+    int64_t  mtimeSec;
+    int64_t  mtimeNsec;
+    uint32_t path;       // offset in the string pool
+    uint32_t reserved;
+} tInodeDir;
+
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    uint32_t path;       // offset in the string pool
+    uint32_t used;
+} tInodeEntry;
+
+typedef struct sInodeIndex {
+    struct sInodeIndex * next;
+    string        root;
+
+    tInodeDir   * dirs;
+    uint32_t      dirCount;
+    uint32_t      dirSize;
+    tInodeEntry * table;
+    uint32_t      tableSize;
+    uint32_t      fileCount;
+    char        * pool;
+    uint32_t      poolSize;
+    uint32_t      poolUsed;
+
+    void        * mapping;   // if loaded from the cache, the arrays point into this
+    size_t        mappingLength;
+} tInodeIndex;
+
+static tInodeIndex * gInodeIndexes = NULL;
+
+static size_t inodeSlot( const tInodeIndex * index, uint64_t device, uint64_t inode )
+{
+    uint64_t h = ( inode ^ (device << 40) ) * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 32) & ( index->tableSize - 1 );
+}
+
+static uint32_t addToPool( tInodeIndex * index, string s )
+{
+    size_t length = strlen( s ) + 1;
+
+    if ( index->poolUsed + length > index->poolSize )
+    {
+        uint32_t size = ( index->poolSize == 0 ) ? 65536 : index->poolSize;
+        while ( index->poolUsed + length > size )
+        {
+            size *= 2;
+        }
+        char * pool = realloc( index->pool, size );
+        if ( pool == NULL )
+        {
+            return UINT32_MAX;
+        }
+        index->pool     = pool;
+        index->poolSize = size;
+    }
+    uint32_t offset = index->poolUsed;
+    memcpy( &index->pool[ offset ], s, length );
+    index->poolUsed += length;
+    return offset;
+}
+
+static void insertInode( tInodeIndex * index, uint64_t device, uint64_t inode, uint32_t path )
+{
+    if ( (index->fileCount + 1) * 2 > index->tableSize )
+    {
+        tInodeEntry * old  = index->table;
+        uint32_t      size = index->tableSize;
+
+        index->tableSize = ( size == 0 ) ? 1024 : size * 2;
+        index->table     = calloc( index->tableSize, sizeof(tInodeEntry) );
+        if ( index->table == NULL )
+        {
+            index->table     = old;
+            index->tableSize = size;
+            return;
+        }
+        index->fileCount = 0;
+        for ( uint32_t i = 0; i < size; ++i )
+        {
+            if ( old[i].used )
+            {
+                insertInode( index, old[i].device, old[i].inode, old[i].path );
+            }
+        }
+        free( old );
+    }
+
+    size_t slot = inodeSlot( index, device, inode );
+    while ( index->table[ slot ].used )
+    {
+        if ( index->table[ slot ].device == device && index->table[ slot ].inode == inode )
+        {
+            return;   // another link to a file we already have
+        }
+        slot = (slot + 1) & (index->tableSize - 1);
+    }
+    index->table[ slot ].device = device;
+    index->table[ slot ].inode  = inode;
+    index->table[ slot ].path   = path;
+    index->table[ slot ].used   = 1;
+    ++index->fileCount;
+}
+
+static void addDirectory( tInodeIndex * index, string path, const struct timespec * mtime )
+{
+    if ( index->dirCount >= index->dirSize )
+    {
+        uint32_t size = ( index->dirSize == 0 ) ? 256 : index->dirSize * 2;
+        tInodeDir * dirs = realloc( index->dirs, size * sizeof(tInodeDir) );
+        if ( dirs == NULL )
+        {
+            return;
+        }
+        index->dirs    = dirs;
+        index->dirSize = size;
+    }
+    tInodeDir * dir = &index->dirs[ index->dirCount++ ];
+    dir->mtimeSec  = mtime->tv_sec;
+    dir->mtimeNsec = mtime->tv_nsec;
+    dir->path      = addToPool( index, path );
+    dir->reserved  = 0;
+}
+
+static void indexEntry( void * context, const tWalkEntry * entry )
+{
+    tInodeIndex * index = context;
+
+    if ( S_ISDIR( entry->mode ) )
+    {
+        addDirectory( index, entry->path, &entry->mtime );
+    }
+    else if ( S_ISREG( entry->mode ) && entry->links > 1 )
+    {
+        uint32_t path = addToPool( index, entry->path );
+        if ( path != UINT32_MAX )
+        {
+            insertInode( index, entry->device, entry->inode, path );
+        }
+    }
+}
+
+static void cacheFileName( char * buffer, size_t size, string cacheDir, string root )
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for ( const unsigned char * p = (const unsigned char *)root; *p != '\0'; p++ )
+    {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+    snprintf( buffer, size, "%s/%016llx.inodes.cache", cacheDir, (unsigned long long)hash );
+}
+
+/**
+ * @brief map in a saved index, if every directory in it is unchanged
+ */
+static int loadInodeIndex( tInodeIndex * index, string cacheDir )
+{
+    char        cacheFile[ PATH_MAX ];
+    struct stat cacheStat;
+
+    cacheFileName( cacheFile, sizeof(cacheFile), cacheDir, index->root );
+
+    int fd = open( cacheFile, O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 )
+    {
+        return -1;
+    }
+
+    void * base = MAP_FAILED;
+    if ( fstat( fd, &cacheStat ) == 0 && (size_t)cacheStat.st_size >= sizeof(tInodeIndexHeader) )
+    {
+        base = mmap( NULL, cacheStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    }
+    close( fd );
+
+    if ( base == MAP_FAILED )
+    {
+        return -1;
+    }
+
+    const tInodeIndexHeader * header = base;
+    size_t expected = sizeof(tInodeIndexHeader)
+                    + (size_t)header->dirCount  * sizeof(tInodeDir)
+                    + (size_t)header->tableSize * sizeof(tInodeEntry)
+                    + header->poolSize;
+
+    tInodeDir   * dirs  = (tInodeDir *)(header + 1);
+    tInodeEntry * table = (tInodeEntry *)(dirs + header->dirCount);
+    char        * pool  = (char *)(table + header->tableSize);
+
+    int fresh = header->magic == kInodeIndexMagic && header->version == kInodeIndexVersion
+             && expected == (size_t)cacheStat.st_size && header->dirCount > 0
+             && header->poolSize > 0 && pool[ header->poolSize - 1 ] == '\0'
+             && ( header->tableSize & (header->tableSize - 1) ) == 0
+             && header->fileCount < header->tableSize;
+
+    // every path has to be in the pool, and the count right, so a lookup always reaches an unused slot
+    uint32_t used = 0;
+    for ( uint32_t i = 0; fresh && i < header->tableSize; ++i )
+    {
+        if ( table[i].used )
+        {
+            fresh = table[i].path < header->poolSize;
+            ++used;
+        }
+    }
+    fresh = fresh && used == header->fileCount;
+
+    // the first directory is the root itself
+    fresh = fresh && dirs[0].path < header->poolSize
+                  && strcmp( &pool[ dirs[0].path ], index->root ) == 0;
+
+    for ( uint32_t i = 0; fresh && i < header->dirCount; ++i )
+    {
+        struct stat dirStat;
+        fresh = dirs[i].path < header->poolSize
+             && stat( &pool[ dirs[i].path ], &dirStat ) == 0
+             && dirStat.st_mtim.tv_sec  == dirs[i].mtimeSec
+             && dirStat.st_mtim.tv_nsec == dirs[i].mtimeNsec;
+    }
+
+    if ( !fresh )
+    {
+        debugf( 3, "stale inode index: \'%s\'\n", cacheFile );
+        munmap( base, cacheStat.st_size );
+        return -1;
+    }
+
+    index->mapping       = base;
+    index->mappingLength = cacheStat.st_size;
+    index->dirs          = dirs;
+    index->dirCount      = header->dirCount;
+    index->table         = table;
+    index->tableSize     = header->tableSize;
+    index->fileCount     = header->fileCount;
+    index->pool          = pool;
+    index->poolUsed      = header->poolSize;
+
+    debugf( 2, "mapped inode index: \'%s\', %u files in %u directories\n",
+            cacheFile, index->fileCount, index->dirCount );
+    return 0;
+}
+
+static int saveInodeIndex( tInodeIndex * index, string cacheDir )
+{
+    char cacheFile[ PATH_MAX ];
+    char tempFile[ PATH_MAX + 16 ];
+    tInodeIndexHeader header;
+
+    cacheFileName( cacheFile, sizeof(cacheFile), cacheDir, index->root );
+    snprintf( tempFile, sizeof(tempFile), "%s.%d", cacheFile, (int)getpid() );
+
+    FILE * file = fopen( tempFile, "w" );
+    if ( file == NULL )
+    {
+        fprintf( stderr, "### Error: Unable to create inode index \'%s\' (%d: %s)\n",
+                 tempFile, errno, strerror(errno) );
+        return errno;
+    }
+
+    memset( &header, 0, sizeof(header) );
+    header.magic     = kInodeIndexMagic;
+    header.version   = kInodeIndexVersion;
+    header.dirCount  = index->dirCount;
+    header.tableSize = index->tableSize;
+    header.fileCount = index->fileCount;
+    header.poolSize  = index->poolUsed;
+
+    int ok = fwrite( &header, sizeof(header), 1, file ) == 1
+          && fwrite( index->dirs, sizeof(tInodeDir), index->dirCount, file ) == index->dirCount
+          && fwrite( index->table, sizeof(tInodeEntry), index->tableSize, file ) == index->tableSize
+          && fwrite( index->pool, 1, index->poolUsed, file ) == index->poolUsed;
+
+    if ( fclose( file ) != 0 || !ok || rename( tempFile, cacheFile ) != 0 )
+    {
+        fprintf( stderr, "### Error: Unable to write inode index \'%s\' (%d: %s)\n",
+                 cacheFile, errno, strerror(errno) );
+        remove( tempFile );
+        return -1;
+    }
+    return 0;
+}
+
+static tInodeIndex * getInodeIndex( string root, string cacheDir )
+{
+    tInodeIndex * index;
+
+    for ( index = gInodeIndexes; index != NULL; index = index->next )
+    {
+        if ( strcmp( index->root, root ) == 0 )
+        {
+            return index;
+        }
+    }
+
+    index = calloc( 1, sizeof(tInodeIndex) );
+    if ( index == NULL )
+    {
+        return NULL;
+    }
+    index->root = strdup( root );
+    index->next = gInodeIndexes;
+    gInodeIndexes = index;
+
+    if ( cacheDir != NULL && loadInodeIndex( index, cacheDir ) == 0 )
+    {
+        return index;
+    }
+
+    struct stat rootStat;
+    if ( stat( root, &rootStat ) != 0 )
+    {
+        fprintf( stderr, "### Error: Unable to index \'%s\' (%d: %s)\n",
+                 root, errno, strerror(errno) );
+        return index;   // leave it empty, so we don't keep trying
+    }
+    addDirectory( index, root, &rootStat.st_mtim );
+    index->tableSize = 1024;
+    index->table     = calloc( index->tableSize, sizeof(tInodeEntry) );
+    if ( index->table == NULL )
+    {
+        index->tableSize = 0;
+        return index;
+    }
+    walkTree( root, 0, indexEntry, index );
+
+    debugf( 2, "indexed \'%s\', %u files in %u directories\n", root, index->fileCount, index->dirCount );
+
+    if ( cacheDir != NULL )
+    {
+        saveInodeIndex( index, cacheDir );
+    }
+    return index;
+}
+
+/**
+ * @brief find a file in the library under 'root' that is the same file as (device, inode)
+ * @return the path to it, or NULL if there isn't one
+ */
+string findLinkedPath( string root, string cacheDir, dev_t device, ino_t inode )
+{
+    tInodeIndex * index = getInodeIndex( root, cacheDir );
+
+    if ( index == NULL || index->tableSize == 0 )
+    {
+        return NULL;
+    }
+
+    for ( size_t slot = inodeSlot( index, device, inode ); index->table[ slot ].used;
+          slot = (slot + 1) & (index->tableSize - 1) )
+    {
+        const tInodeEntry * entry = &index->table[ slot ];
+        if ( entry->device == (uint64_t)device && entry->inode == (uint64_t)inode )
+        {
+            return &index->pool[ entry->path ];
+        }
+    }
+    return NULL;
+}
+
+void releaseInodeIndexes( void )
+{
+    tInodeIndex * index = gInodeIndexes;
+
+    while ( index != NULL )
+    {
+        tInodeIndex * next = index->next;
+
+        if ( index->mapping != NULL )
+        {
+            munmap( index->mapping, index->mappingLength );
+        }
+        else
+        {
+            free( index->dirs );
+            free( index->table );
+            free( index->pool );
+        }
+        free( (void *)index->root );
+        free( index );
+        index = next;
+    }
+    gInodeIndexes = NULL;
+}
@@ -0,0 +1,13 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_INODEINDEX_H
+#define DVR2PLEX_INODEINDEX_H
+
+#include <sys/types.h>
+
+string findLinkedPath( string root, string cacheDir, dev_t device, ino_t inode );
+void   releaseInodeIndexes( void );
+
+#endif // DVR2PLEX_INODEINDEX_H
@@ -0,0 +1,232 @@
+//
+// Created by paul on 10/19/26.
+//
+// Debug output. Writing every debugf() straight to an unbuffered stderr
+// makes verbose runs many times slower than quiet ones, which rather gets
+// in the way of observing what's going on. So instead, each thread formats
+// its messages into its own ring buffer, and a background thread drains the
+// rings and writes them out in large chunks.
+//
+// Each ring has exactly one producer (the thread that owns it) and one
+// consumer at a time, so writing to it needs no locks, just a pair of
+// atomic counters. The consumer is usually the flusher thread, but a thread
+// that is exiting, or that logs once the flusher has stopped, drains its
+// own ring. gRingMutex serializes the consumers, and guards the list of
+// rings, since a ring is unlinked and freed when its thread exits. Messages are formatted when they are logged rather than
+// when they're flushed, since many of the strings they refer to (e.g. the
+// tokens of a name) are modified in place or freed shortly afterwards.
+//
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "log.h"
+
+#define kLogRingSize    (64 * 1024)   // must be a power of two
+#define kLogMaxMessage  1024
+
+typedef struct sLogRing {
+    struct sLogRing * next;
+    atomic_size_t     head;   // total bytes written by the owning thread
+    atomic_size_t     tail;   // total bytes consumed by the flusher
+    char              buffer[ kLogRingSize ];
+} tLogRing;
+
+static tLogRing      * gRings    = NULL;     // guarded by gRingMutex
+static pthread_mutex_t gRingMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t   gRingKey;              // so a thread's ring is freed when it exits
+static _Thread_local tLogRing * tRing = NULL;
+
+static pthread_once_t gLogOnce = PTHREAD_ONCE_INIT;
+static pthread_t      gFlusher;
+static atomic_int     gFlusherRunning = 0;
+static atomic_int     gStopping       = 0;
+
+/**
+ * @brief write out whatever is waiting in a ring
+ * @return the number of bytes written
+ */
+static size_t drainRing( tLogRing * ring )
+{
+    size_t head = atomic_load( &ring->head );   // ordered with gFlusherRunning, see logPrintf()
+    size_t tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+    size_t count = head - tail;
+
+    while ( tail != head )
+    {
+        size_t offset = tail & (kLogRingSize - 1);
+        size_t length = head - tail;
+
+        if ( length > kLogRingSize - offset )
+        {
+            length = kLogRingSize - offset;   // up to the wrap, the rest next time around
+        }
+
+        ssize_t written = write( STDERR_FILENO, &ring->buffer[ offset ], length );
+        if ( written <= 0 )
+        {
+            break;   // nowhere to put it, so discard what's left
+        }
+        tail += written;
+        atomic_store_explicit( &ring->tail, tail, memory_order_release );
+    }
+    atomic_store_explicit( &ring->tail, head, memory_order_release );
+
+    return count;
+}
+
+static void drainRings( size_t * total )
+{
+    pthread_mutex_lock( &gRingMutex );
+    for ( tLogRing * ring = gRings; ring != NULL; ring = ring->next )
+    {
+        *total += drainRing( ring );
+    }
+    pthread_mutex_unlock( &gRingMutex );
+}
+
+/**
+ * @brief called as a thread exits, to write out what's left in its ring, and free it
+ */
+static void releaseRing( void * value )
+{
+    tLogRing * ring = value;
+
+    pthread_mutex_lock( &gRingMutex );
+    drainRing( ring );
+    for ( tLogRing ** link = &gRings; *link != NULL; link = &(*link)->next )
+    {
+        if ( *link == ring )
+        {
+            *link = ring->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock( &gRingMutex );
+    free( ring );
+}
+
+static void * flusherThread( void * unused )
+{
+    (void)unused;
+    const struct timespec idle = { 0, 5 * 1000 * 1000 };   // 5ms
+
+    while ( !atomic_load( &gStopping ) )
+    {
+        size_t total = 0;
+        drainRings( &total );
+        if ( total == 0 )
+        {
+            nanosleep( &idle, NULL );
+        }
+    }
+    return NULL;
+}
+
+void logFlush( void )
+{
+    size_t total = 0;
+
+    if ( atomic_exchange( &gFlusherRunning, 0 ) )
+    {
+        atomic_store( &gStopping, 1 );
+        pthread_join( gFlusher, NULL );
+    }
+    drainRings( &total );
+}
+
+static void startFlusher( void )
+{
+    if ( pthread_key_create( &gRingKey, releaseRing ) == 0
+      && pthread_create( &gFlusher, NULL, flusherThread, NULL ) == 0 )
+    {
+        atomic_store( &gFlusherRunning, 1 );
+        atexit( logFlush );
+    }
+}
+
+static tLogRing * getRing( void )
+{
+    if ( tRing == NULL )
+    {
+        tRing = calloc( 1, sizeof(tLogRing) );
+        if ( tRing != NULL )
+        {
+            pthread_mutex_lock( &gRingMutex );
+            tRing->next = gRings;
+            gRings = tRing;
+            pthread_mutex_unlock( &gRingMutex );
+            pthread_setspecific( gRingKey, tRing );
+        }
+    }
+    return tRing;
+}
+
+void logPrintf( const char * format, ... )
+{
+    char    message[ kLogMaxMessage ];
+    va_list args;
+    int     length;
+
+    va_start( args, format );
+    length = vsnprintf( message, sizeof(message), format, args );
+    va_end( args );
+
+    if ( length < 0 )
+    {
+        return;
+    }
+    if ( (size_t)length >= sizeof(message) )
+    {
+        length = sizeof(message) - 1;
+    }
+
+    pthread_once( &gLogOnce, startFlusher );
+
+    tLogRing * ring = atomic_load( &gFlusherRunning ) ? getRing() : NULL;
+    if ( ring == NULL )
+    {
+        // no background flusher, so fall back to writing it directly
+        fputs( message, stderr );
+        return;
+    }
+
+    size_t head = atomic_load_explicit( &ring->head, memory_order_relaxed );
+
+    // wait for the flusher to make room, rather than lose the message
+    while ( kLogRingSize - (head - atomic_load_explicit( &ring->tail, memory_order_acquire )) < (size_t)length )
+    {
+        if ( !atomic_load( &gFlusherRunning ) )
+        {
+            fputs( message, stderr );
+            return;
+        }
+        sched_yield();
+    }
+
+    size_t offset = head & (kLogRingSize - 1);
+    size_t first  = kLogRingSize - offset;
+    if ( first > (size_t)length )
+    {
+        first = length;
+    }
+    memcpy( &ring->buffer[ offset ], message, first );
+    memcpy( &ring->buffer[ 0 ], message + first, length - first );
+
+    atomic_store( &ring->head, head + length );
+
+    // if the flusher stopped meanwhile, its last pass may have missed this, so write it out here
+    if ( !atomic_load( &gFlusherRunning ) )
+    {
+        pthread_mutex_lock( &gRingMutex );
+        drainRing( ring );
+        pthread_mutex_unlock( &gRingMutex );
+    }
+}
@@ -0,0 +1,11 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_LOG_H
+#define DVR2PLEX_LOG_H
+
+void logPrintf( const char * format, ... ) __attribute__(( format( printf, 1, 2 ) ));
+void logFlush( void );
+
+#endif // DVR2PLEX_LOG_H
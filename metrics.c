@@ -0,0 +1,224 @@
+//
+// Created by paul on 10/19/26.
+//
+// Counters and latency histograms, written out in the Prometheus text
+// exposition format to a file that node_exporter's textfile collector
+// picks up. The file is rewritten periodically by a background thread
+// (and once more at exit), always via a temporary file and a rename, so
+// node_exporter never sees a partially written file.
+//
+#define _XOPEN_SOURCE 700
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "metrics.h"
+
+typedef struct {
+    string name;
+    string help;
+} tMetricInfo;
+
+static const tMetricInfo kMetricInfo[ kMetricCount ] = {
+    [kMetricFiles]           = { "dvr2plex_files_processed_total", "Files processed." },
+    [kMetricParseFailures]   = { "dvr2plex_parse_failures_total",  "Files where no series or episode was found in the name." },
+    [kMetricSeriesMatched]   = { "dvr2plex_series_matched_total",  "Series names matched to a folder in the destination." },
+    [kMetricSeriesUnmatched] = { "dvr2plex_series_unmatched_total","Series names passed through without a match." },
+    [kMetricActions]         = { "dvr2plex_actions_total",         "Output strings executed." },
+    [kMetricActionFailures]  = { "dvr2plex_action_failures_total", "Executed output strings that returned a non-zero status." }
+};
+
+static const tMetricInfo kHistogramInfo[ kHistogramCount ] = {
+    [kHistogramResolve] = { "dvr2plex_resolve_seconds", "Time taken to resolve the output string for a file." },
+    [kHistogramAction]  = { "dvr2plex_action_seconds",  "Time taken to execute the output string for a file." }
+};
+
+/* upper bounds of the histogram buckets, in microseconds. +Inf is implied */
+static const uint64_t kBucketBounds[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+#define kBucketCount (sizeof(kBucketBounds) / sizeof(kBucketBounds[0]))
+
+typedef struct {
+    atomic_uint_fast64_t bucket[ kBucketCount + 1 ];   // not cumulative, last is +Inf
+    atomic_uint_fast64_t sum;                          // microseconds
+} tHistogramData;
+
+static atomic_uint_fast64_t gCounters[ kMetricCount ];
+static tHistogramData       gHistograms[ kHistogramCount ];
+
+static string          gMetricsPath     = NULL;
+static unsigned int    gMetricsInterval = 0;
+static pthread_t       gMetricsThread;
+static int             gMetricsRunning  = 0;
+static pthread_mutex_t gMetricsMutex    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  gMetricsWake     = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @brief a timestamp in microseconds, to pass to metricObserve() later
+ */
+uint64_t metricClock( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void metricIncrement( tMetric metric )
+{
+    atomic_fetch_add_explicit( &gCounters[ metric ], 1, memory_order_relaxed );
+}
+
+/**
+ * @brief record the time elapsed since 'start' (from metricClock) in a histogram
+ */
+void metricObserve( tHistogram histogram, uint64_t start )
+{
+    tHistogramData * data = &gHistograms[ histogram ];
+    uint64_t elapsed = metricClock() - start;
+    unsigned int i = 0;
+
+    while ( i < kBucketCount && elapsed > kBucketBounds[ i ] )
+    {
+        ++i;
+    }
+    atomic_fetch_add_explicit( &data->bucket[ i ], 1, memory_order_relaxed );
+    atomic_fetch_add_explicit( &data->sum, elapsed, memory_order_relaxed );
+}
+
+static int writeMetrics( void )
+{
+    char   temp[ PATH_MAX + 16 ];
+    FILE * file;
+
+    snprintf( temp, sizeof(temp), "%s.tmp", gMetricsPath );
+    file = fopen( temp, "w" );
+    if ( file == NULL )
+    {
+        fprintf( stderr, "### Error: Unable to create metrics file \'%s\' (%d: %s)\n",
+                 temp, errno, strerror(errno) );
+        return errno;
+    }
+
+    for ( unsigned int m = 0; m < kMetricCount; ++m )
+    {
+        fprintf( file, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+                 kMetricInfo[m].name, kMetricInfo[m].help, kMetricInfo[m].name, kMetricInfo[m].name,
+                 (unsigned long long)atomic_load( &gCounters[m] ) );
+    }
+
+    for ( unsigned int h = 0; h < kHistogramCount; ++h )
+    {
+        tHistogramData * data = &gHistograms[h];
+        string name = kHistogramInfo[h].name;
+        unsigned long long cumulative = 0;
+
+        fprintf( file, "# HELP %s %s\n# TYPE %s histogram\n", name, kHistogramInfo[h].help, name );
+        for ( unsigned int i = 0; i < kBucketCount; ++i )
+        {
+            cumulative += atomic_load( &data->bucket[i] );
+            fprintf( file, "%s_bucket{le=\"%g\"} %llu\n", name, kBucketBounds[i] / 1e6, cumulative );
+        }
+        cumulative += atomic_load( &data->bucket[ kBucketCount ] );
+        fprintf( file, "%s_bucket{le=\"+Inf\"} %llu\n", name, cumulative );
+        fprintf( file, "%s_sum %g\n", name, atomic_load( &data->sum ) / 1e6 );
+        fprintf( file, "%s_count %llu\n", name, cumulative );
+    }
+
+    if ( fclose( file ) != 0 || rename( temp, gMetricsPath ) != 0 )
+    {
+        fprintf( stderr, "### Error: Unable to write metrics file \'%s\' (%d: %s)\n",
+                 gMetricsPath, errno, strerror(errno) );
+        remove( temp );
+        return errno;
+    }
+    return 0;
+}
+
+static void * metricsThread( void * unused )
+{
+    (void)unused;
+    struct timespec deadline;
+
+    pthread_mutex_lock( &gMetricsMutex );
+    while ( gMetricsRunning )
+    {
+        clock_gettime( CLOCK_REALTIME, &deadline );
+        deadline.tv_sec += gMetricsInterval;
+        while ( gMetricsRunning
+             && pthread_cond_timedwait( &gMetricsWake, &gMetricsMutex, &deadline ) != ETIMEDOUT )
+        {
+            /* spurious wakeup, or we're being shut down */
+        }
+        if ( gMetricsRunning )
+        {
+            writeMetrics();
+        }
+    }
+    pthread_mutex_unlock( &gMetricsMutex );
+    return NULL;
+}
+
+/**
+ * @brief start writing metrics to 'path' every 'interval' seconds (0 means only at exit)
+ */
+int metricsOpen( string path, unsigned int interval )
+{
+    if ( gMetricsPath != NULL )
+    {
+        return 0;
+    }
+    gMetricsPath     = strdup( path );
+    gMetricsInterval = interval;
+
+    int result = writeMetrics();
+
+    if ( interval > 0 )
+    {
+        gMetricsRunning = 1;
+        if ( pthread_create( &gMetricsThread, NULL, metricsThread, NULL ) != 0 )
+        {
+            fprintf( stderr, "### Error: Unable to start metrics thread\n" );
+            gMetricsRunning = 0;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief stop the periodic writer, and write the final values
+ */
+int metricsClose( void )
+{
+    int result;
+
+    if ( gMetricsPath == NULL )
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock( &gMetricsMutex );
+    int running = gMetricsRunning;
+    gMetricsRunning = 0;
+    pthread_cond_signal( &gMetricsWake );
+    pthread_mutex_unlock( &gMetricsMutex );
+    if ( running )
+    {
+        pthread_join( gMetricsThread, NULL );
+    }
+
+    result = writeMetrics();
+
+    free( (void *)gMetricsPath );
+    gMetricsPath = NULL;
+    return result;
+}
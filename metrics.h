@@ -0,0 +1,33 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_METRICS_H
+#define DVR2PLEX_METRICS_H
+
+#include <stdint.h>
+
+typedef enum {
+    kMetricFiles,
+    kMetricParseFailures,
+    kMetricSeriesMatched,
+    kMetricSeriesUnmatched,
+    kMetricActions,
+    kMetricActionFailures,
+    kMetricCount
+} tMetric;
+
+typedef enum {
+    kHistogramResolve,
+    kHistogramAction,
+    kHistogramCount
+} tHistogram;
+
+uint64_t metricClock( void );
+void     metricIncrement( tMetric metric );
+void     metricObserve( tHistogram histogram, uint64_t start );
+
+int  metricsOpen( string path, unsigned int interval );
+int  metricsClose( void );
+
+#endif // DVR2PLEX_METRICS_H
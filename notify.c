@@ -0,0 +1,358 @@
+//
+// Created by paul on 10/19/26.
+//
+// Tell a media server which directories have changed, so it can rescan
+// them. Rather than one request per file, the distinct directories are
+// collected, and one request is sent per directory when notifyFlush() is
+// called, i.e. at the end of a run, or once the input has gone quiet for a
+// while when reading from stdin.
+//
+// The request is a plain HTTP/1.0 GET of the configured URL with the
+// URL-encoded directory appended, e.g. for Plex:
+//   http://127.0.0.1:32400/library/sections/2/refresh?X-Plex-Token=xxx&path=
+// Several requests are kept in flight at once, up to kNotifyInFlight, using
+// non-blocking sockets and poll(). Only http:// is supported.
+//
+#define _GNU_SOURCE
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "notify.h"
+
+#define kNotifyInFlight  4
+#define kNotifyTimeout   10000   // milliseconds, for each request
+
+typedef struct sNotifyDir {
+    struct sNotifyDir * next;
+    char                path[];
+} tNotifyDir;
+
+typedef enum {
+    kRequestIdle,
+    kRequestConnecting,
+    kRequestSending,
+    kRequestReceiving
+} tRequestState;
+
+typedef struct {
+    tRequestState state;
+    int           fd;
+    char        * request;
+    size_t        length;
+    size_t        sent;
+    char          status[ 16 ];   // enough of the response to see the status code
+    size_t        received;
+    string        directory;
+    struct timespec started;
+} tRequest;
+
+static char       * gNotifyHost   = NULL;
+static char       * gNotifyPort   = NULL;
+static char       * gNotifyPath   = NULL;   // path and query, up to where the directory is appended
+static tNotifyDir * gNotifyDirs   = NULL;
+static unsigned int gNotifyCount  = 0;
+
+/**
+ * @brief set the URL to notify. Only http://host[:port]/path is understood
+ */
+int notifyOpen( string url )
+{
+    if ( strncasecmp( url, "http://", 7 ) != 0 )
+    {
+        fprintf( stderr, "### Error: notify url \'%s\' must start with http://\n", url );
+        return -1;
+    }
+
+    string host = url + 7;
+    string path = strchr( host, '/' );
+    if ( path == NULL )
+    {
+        path = host + strlen( host );
+    }
+    string port = memchr( host, ':', path - host );
+
+    gNotifyHost = strndup( host, ( port != NULL ? port : path ) - host );
+    gNotifyPort = ( port != NULL ) ? strndup( port + 1, path - port - 1 ) : strdup( "80" );
+    gNotifyPath = strdup( *path != '\0' ? path : "/" );
+
+    debugf( 2, "notify: host \'%s\', port \'%s\', path \'%s\'\n", gNotifyHost, gNotifyPort, gNotifyPath );
+    return 0;
+}
+
+/**
+ * @brief remember a directory that needs to be rescanned, unless we already have it
+ */
+void notifyAdd( string directory )
+{
+    if ( gNotifyHost == NULL )
+    {
+        return;
+    }
+    for ( tNotifyDir * dir = gNotifyDirs; dir != NULL; dir = dir->next )
+    {
+        if ( strcmp( dir->path, directory ) == 0 )
+        {
+            return;
+        }
+    }
+
+    size_t length = strlen( directory ) + 1;
+    tNotifyDir * dir = malloc( sizeof(tNotifyDir) + length );
+    if ( dir != NULL )
+    {
+        memcpy( dir->path, directory, length );
+        dir->next   = gNotifyDirs;
+        gNotifyDirs = dir;
+        ++gNotifyCount;
+    }
+}
+
+int notifyPending( void )
+{
+    return gNotifyDirs != NULL;
+}
+
+static char * buildRequest( string directory, size_t * length )
+{
+    size_t size = strlen( gNotifyPath ) + 3 * strlen( directory ) + strlen( gNotifyHost ) + 128;
+    char * request = malloc( size );
+    char * r = request;
+
+    if ( request == NULL )
+    {
+        return NULL;
+    }
+
+    r += sprintf( r, "GET %s", gNotifyPath );
+    for ( const unsigned char * d = (const unsigned char *)directory; *d != '\0'; d++ )
+    {
+        if ( isalnum( *d ) || *d == '-' || *d == '_' || *d == '.' || *d == '~' )
+        {
+            *r++ = *d;
+        }
+        else
+        {
+            r += sprintf( r, "%%%02X", *d );
+        }
+    }
+    r += sprintf( r, " HTTP/1.0\r\nHost: %s\r\nUser-Agent: DVR2Plex\r\n\r\n", gNotifyHost );
+
+    *length = r - request;
+    return request;
+}
+
+static void finishRequest( tRequest * request, int * failures )
+{
+    int ok = ( request->received >= 12 && strncmp( request->status, "HTTP/1.", 7 ) == 0
+               && request->status[9] == '2' );
+
+    if ( !ok )
+    {
+        fprintf( stderr, "### Error: refresh of \'%s\' failed (%.12s)\n",
+                 request->directory, request->received > 0 ? request->status : "no response" );
+        ++*failures;
+    }
+    else
+    {
+        debugf( 2, "notified \'%s\'\n", request->directory );
+    }
+
+    if ( request->fd >= 0 )
+    {
+        close( request->fd );
+    }
+    free( request->request );
+    memset( request, 0, sizeof(tRequest) );
+    request->fd = -1;
+}
+
+static int startRequest( tRequest * request, const struct addrinfo * address, tNotifyDir * dir )
+{
+    request->directory = dir->path;
+    request->request   = buildRequest( dir->path, &request->length );
+    request->sent      = 0;
+    request->received  = 0;
+    clock_gettime( CLOCK_MONOTONIC, &request->started );
+
+    request->fd = socket( address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          address->ai_protocol );
+    if ( request->request == NULL || request->fd < 0 )
+    {
+        return -1;
+    }
+    if ( connect( request->fd, address->ai_addr, address->ai_addrlen ) != 0 && errno != EINPROGRESS )
+    {
+        return -1;
+    }
+    request->state = kRequestConnecting;
+    return 0;
+}
+
+static int elapsed( const struct timespec * since )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (int)( (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000 );
+}
+
+/**
+ * @brief send a refresh request for each directory collected so far
+ * @return the number of requests that failed
+ */
+int notifyFlush( void )
+{
+    tRequest         request[ kNotifyInFlight ];
+    struct pollfd    polled[ kNotifyInFlight ];
+    struct addrinfo  hints;
+    struct addrinfo * address = NULL;
+    int failures = 0;
+
+    if ( gNotifyDirs == NULL )
+    {
+        return 0;
+    }
+
+    memset( &hints, 0, sizeof(hints) );
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int error = getaddrinfo( gNotifyHost, gNotifyPort, &hints, &address );
+    if ( error != 0 )
+    {
+        fprintf( stderr, "### Error: unable to look up \'%s\' (%s)\n", gNotifyHost, gai_strerror( error ) );
+        return gNotifyCount;   // keep them for next time
+    }
+
+    memset( request, 0, sizeof(request) );
+    for ( int i = 0; i < kNotifyInFlight; ++i )
+    {
+        request[i].fd = -1;
+    }
+
+    tNotifyDir * pending = gNotifyDirs;   // freed once everything is sent
+    tNotifyDir * next    = pending;
+    int active = 0;
+
+    while ( next != NULL || active > 0 )
+    {
+        // keep as many requests in flight as we're allowed
+        for ( int i = 0; i < kNotifyInFlight && next != NULL; ++i )
+        {
+            if ( request[i].state == kRequestIdle )
+            {
+                if ( startRequest( &request[i], address, next ) != 0 )
+                {
+                    finishRequest( &request[i], &failures );
+                }
+                else
+                {
+                    ++active;
+                }
+                next = next->next;
+            }
+        }
+
+        for ( int i = 0; i < kNotifyInFlight; ++i )
+        {
+            polled[i].fd      = ( request[i].state != kRequestIdle ) ? request[i].fd : -1;
+            polled[i].events  = ( request[i].state == kRequestReceiving ) ? POLLIN : POLLOUT;
+            polled[i].revents = 0;
+        }
+        if ( active > 0 )
+        {
+            poll( polled, kNotifyInFlight, 100 );
+        }
+
+        for ( int i = 0; i < kNotifyInFlight; ++i )
+        {
+            tRequest * r = &request[i];
+            int done = 0;
+
+            if ( r->state == kRequestIdle )
+            {
+                continue;
+            }
+            if ( polled[i].revents & (POLLOUT | POLLIN | POLLHUP | POLLERR) )
+            {
+                if ( r->state == kRequestConnecting )
+                {
+                    int       socketError = 0;
+                    socklen_t length      = sizeof(socketError);
+                    getsockopt( r->fd, SOL_SOCKET, SO_ERROR, &socketError, &length );
+                    done = ( socketError != 0 );
+                    r->state = kRequestSending;
+                }
+                if ( !done && r->state == kRequestSending )
+                {
+                    ssize_t count = send( r->fd, r->request + r->sent, r->length - r->sent, MSG_NOSIGNAL );
+                    if ( count < 0 && errno != EAGAIN )
+                    {
+                        done = 1;
+                    }
+                    else if ( count > 0 && (r->sent += count) == r->length )
+                    {
+                        r->state = kRequestReceiving;
+                    }
+                }
+                else if ( !done && r->state == kRequestReceiving )
+                {
+                    char    buffer[ 4096 ];
+                    ssize_t count = recv( r->fd, buffer, sizeof(buffer), 0 );
+                    if ( count > 0 && r->received < sizeof(r->status) - 1 )
+                    {
+                        size_t keep = sizeof(r->status) - 1 - r->received;
+                        if ( keep > (size_t)count )
+                        {
+                            keep = count;
+                        }
+                        memcpy( r->status + r->received, buffer, keep );
+                    }
+                    if ( count > 0 )
+                    {
+                        r->received += count;
+                    }
+                    done = ( count == 0 || ( count < 0 && errno != EAGAIN ) );
+                }
+            }
+            if ( done || elapsed( &r->started ) > kNotifyTimeout )
+            {
+                finishRequest( r, &failures );
+                --active;
+            }
+        }
+    }
+    freeaddrinfo( address );
+
+    while ( pending != NULL )
+    {
+        tNotifyDir * dir = pending->next;
+        free( pending );
+        pending = dir;
+    }
+    gNotifyDirs  = NULL;
+    gNotifyCount = 0;
+
+    return failures;
+}
+
+void notifyClose( void )
+{
+    notifyFlush();
+
+    free( gNotifyHost );
+    free( gNotifyPort );
+    free( gNotifyPath );
+    gNotifyHost = NULL;
+    gNotifyPort = NULL;
+    gNotifyPath = NULL;
+}
@@ -0,0 +1,14 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_NOTIFY_H
+#define DVR2PLEX_NOTIFY_H
+
+int  notifyOpen( string url );
+void notifyAdd( string directory );
+int  notifyPending( void );
+int  notifyFlush( void );
+void notifyClose( void );
+
+#endif // DVR2PLEX_NOTIFY_H
@@ -0,0 +1,360 @@
+//
+// Created by paul on 10/19/26.
+//
+// The filename patterns we look for (e.g. 'S00E00', '0x00', '(0000)') are
+// compiled into a single DFA. Each pattern is described by a 'spec' string:
+//
+//   0            matches any digit
+//   {name:n}     matches exactly n digits, captured as 'name', one of
+//                season, episode, year, month or day
+//   ( or )       matches any style of left or right bracket
+//
+// Anything else matches that character, ignoring case. Separators can't
+// appear in a spec, since the tokenizer has already split the name on them.
+//
+// All the patterns are fixed-length sequences of character classes, so the
+// DFA is simply a trie of those classes. The tokenizer steps it one character
+// at a time as it scans each token, remembering the value of each digit it
+// passes. When the token ends, the accepting state (if any) identifies the
+// pattern, and says which of those digits make up each captured field.
+//
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "dictionary.h"
+#include "pattern.h"
+
+#define kMaxPatternLength   32
+
+typedef struct {
+    unsigned char c;      // the folded character to match
+    signed char   slot;   // the tCapture it contributes to, or -1
+} tElement;
+
+typedef struct sPatternSpec {
+    struct sPatternSpec * next;
+    tHash        id;
+    unsigned int length;
+    tElement     element[ kMaxPatternLength ];
+} tPatternSpec;
+
+typedef struct {
+    unsigned char slot;
+    unsigned char first;   // index of the first digit of this field
+    unsigned char width;
+} tCaptureLayout;
+
+typedef struct {
+    tHash          id;     // zero if this is not an accepting state
+    unsigned int   count;
+    tCaptureLayout capture[ kCaptureCount ];
+} tPatternAccept;
+
+static const char * kCaptureName[ kCaptureCount ] = {
+    "season", "episode", "year", "month", "day"
+};
+
+static tPatternSpec *   gSpecs    = NULL;
+static tPatternSpec **  gSpecTail = &gSpecs;
+
+/* the compiled DFA. State 0 is the 'dead' state, state 1 is the start state */
+static unsigned char    gClassOf[ 256 ];
+static unsigned int     gClassCount = 0;
+static unsigned short * gNext       = NULL;   // [ state * gClassCount + class ]
+static tPatternAccept * gAccept     = NULL;   // [ state ]
+static unsigned int     gStateCount = 0;
+
+static unsigned char foldChar( unsigned char c )
+{
+    switch ( c )
+    {
+    case '(': case '[': case '{':
+        return '(';
+
+    case ')': case ']': case '}':
+        return ')';
+
+    default:
+        if ( isdigit( c ) )
+        {
+            return '0';
+        }
+        return tolower( c );
+    }
+}
+
+/**
+ * @brief parse a pattern spec, and queue it up to be compiled
+ * @param spec  see above for the syntax
+ * @param id    the value acceptPattern() will return for this pattern
+ * @return 0 if successful
+ */
+int addPattern( string spec, tHash id )
+{
+    tPatternSpec * pattern = calloc( 1, sizeof(tPatternSpec) );
+    unsigned int   seen = 0;
+    string p = spec;
+
+    if ( pattern == NULL )
+    {
+        return -1;
+    }
+    pattern->id = id;
+
+    while ( *p != '\0' )
+    {
+        if ( *p == '{' )
+        {
+            // a captured field, e.g. {season:2}
+            const char * colon = strchr( p, ':' );
+            const char * close = strchr( p, '}' );
+            int slot = -1;
+
+            if ( colon != NULL && close != NULL && colon < close )
+            {
+                for ( int i = 0; i < kCaptureCount; ++i )
+                {
+                    size_t length = strlen( kCaptureName[i] );
+                    if ( (size_t)(colon - p - 1) == length && strncasecmp( p + 1, kCaptureName[i], length ) == 0 )
+                    {
+                        slot = i;
+                        break;
+                    }
+                }
+            }
+
+            unsigned int width = ( slot >= 0 ) ? (unsigned int)atoi( colon + 1 ) : 0;
+            if ( slot < 0 || width == 0 || (seen & (1 << slot)) != 0
+              || pattern->length + width > kMaxPatternLength )
+            {
+                break;
+            }
+            seen |= 1 << slot;
+
+            while ( width-- > 0 )
+            {
+                pattern->element[ pattern->length ].c    = '0';
+                pattern->element[ pattern->length ].slot = slot;
+                pattern->length++;
+            }
+            p = close + 1;
+        }
+        else
+        {
+            if ( strchr( " ._-", *p ) != NULL || pattern->length >= kMaxPatternLength )
+            {
+                break;
+            }
+            pattern->element[ pattern->length ].c    = foldChar( *p );
+            pattern->element[ pattern->length ].slot = -1;
+            pattern->length++;
+            p++;
+        }
+    }
+
+    if ( *p != '\0' || pattern->length == 0 )
+    {
+        fprintf( stderr, "### Error: pattern \'%s\' not understood.\n", spec );
+        free( pattern );
+        return -1;
+    }
+
+    *gSpecTail = pattern;
+    gSpecTail = &pattern->next;
+
+    return 0;
+}
+
+static unsigned int newState( void )
+{
+    unsigned int state = gStateCount++;
+
+    gNext   = realloc( gNext, gStateCount * gClassCount * sizeof(unsigned short) );
+    gAccept = realloc( gAccept, gStateCount * sizeof(tPatternAccept) );
+    if ( gNext == NULL || gAccept == NULL )
+    {
+        fprintf( stderr, "### Error: unable to allocate memory for patterns\n" );
+        exit( -1 );
+    }
+
+    memset( &gNext[ state * gClassCount ], 0, gClassCount * sizeof(unsigned short) );
+    memset( &gAccept[ state ], 0, sizeof(tPatternAccept) );
+
+    return state;
+}
+
+/**
+ * @brief build the DFA from all the patterns that have been added
+ * @return 0 if successful
+ */
+int compilePatterns( void )
+{
+    unsigned char classOfFolded[ 256 ];
+    tPatternSpec * pattern;
+
+    free( gNext );
+    free( gAccept );
+    gNext       = NULL;
+    gAccept     = NULL;
+    gStateCount = 0;
+
+    // first, assign a class to each distinct (folded) character the patterns use.
+    // class zero is for everything else, and always leads to the dead state.
+    memset( classOfFolded, 0, sizeof(classOfFolded) );
+    gClassCount = 1;
+    for ( pattern = gSpecs; pattern != NULL; pattern = pattern->next )
+    {
+        for ( unsigned int i = 0; i < pattern->length; ++i )
+        {
+            unsigned char c = pattern->element[i].c;
+            if ( classOfFolded[ c ] == 0 )
+            {
+                classOfFolded[ c ] = gClassCount++;
+            }
+        }
+    }
+    for ( unsigned int c = 0; c < 256; ++c )
+    {
+        gClassOf[ c ] = ( c != '\0' ) ? classOfFolded[ foldChar( c ) ] : 0;
+    }
+
+    newState();   // the dead state
+    newState();   // the start state
+
+    for ( pattern = gSpecs; pattern != NULL; pattern = pattern->next )
+    {
+        unsigned int state = 1;
+
+        for ( unsigned int i = 0; i < pattern->length; ++i )
+        {
+            unsigned int cls = classOfFolded[ pattern->element[i].c ];
+            if ( gNext[ state * gClassCount + cls ] == 0 )
+            {
+                unsigned int next = newState();
+                gNext[ state * gClassCount + cls ] = next;
+            }
+            state = gNext[ state * gClassCount + cls ];
+        }
+
+        tPatternAccept * accept = &gAccept[ state ];
+        if ( accept->id != 0 )
+        {
+            debugf( 1, "pattern %s duplicates %s, ignored\n", lookupHash( pattern->id ), lookupHash( accept->id ) );
+            continue;
+        }
+        accept->id = pattern->id;
+
+        // work out which digits make up each captured field
+        unsigned int digit = 0;
+        for ( unsigned int i = 0; i < pattern->length; ++i )
+        {
+            tElement * element = &pattern->element[i];
+            if ( element->slot >= 0 )
+            {
+                tCaptureLayout * capture = &accept->capture[ accept->count ];
+                if ( accept->count > 0 && capture[-1].slot == element->slot )
+                {
+                    capture[-1].width++;
+                }
+                else
+                {
+                    capture->slot  = element->slot;
+                    capture->first = digit;
+                    capture->width = 1;
+                    accept->count++;
+                }
+            }
+            if ( element->c == '0' )
+            {
+                ++digit;
+            }
+        }
+    }
+
+    debugf( 3, "patterns: %u states, %u classes\n", gStateCount, gClassCount );
+    return 0;
+}
+
+void releasePatterns( void )
+{
+    tPatternSpec * pattern = gSpecs;
+    while ( pattern != NULL )
+    {
+        tPatternSpec * next = pattern->next;
+        free( pattern );
+        pattern = next;
+    }
+    gSpecs    = NULL;
+    gSpecTail = &gSpecs;
+
+    free( gNext );
+    free( gAccept );
+    gNext       = NULL;
+    gAccept     = NULL;
+    gStateCount = 0;
+}
+
+void resetPattern( tPatternState * state )
+{
+    state->state  = ( gStateCount > 1 ) ? 1 : 0;
+    state->digits = 0;
+}
+
+/**
+ * @brief advance the DFA by one character of the token
+ */
+void stepPattern( tPatternState * state, unsigned char c )
+{
+    if ( state->state != 0 )
+    {
+        state->state = gNext[ state->state * gClassCount + gClassOf[ c ] ];
+
+        if ( isdigit( c ) )
+        {
+            if ( state->digits < kMaxPatternDigits )
+            {
+                state->digit[ state->digits++ ] = c - '0';
+            }
+            else
+            {
+                state->state = 0;
+            }
+        }
+    }
+}
+
+/**
+ * @brief at the end of a token, check if the DFA is in an accepting state
+ * @return non-zero if it matched a pattern, in which case 'match' is filled in
+ */
+int acceptPattern( const tPatternState * state, tPatternMatch * match )
+{
+    const tPatternAccept * accept;
+
+    match->captured = 0;
+    memset( match->value, 0, sizeof(match->value) );
+    if ( state->state == 0 || gAccept[ state->state ].id == 0 )
+    {
+        return 0;
+    }
+    accept = &gAccept[ state->state ];
+
+    match->id = accept->id;
+    for ( unsigned int i = 0; i < accept->count; ++i )
+    {
+        const tCaptureLayout * capture = &accept->capture[i];
+        unsigned int value = 0;
+
+        for ( unsigned int d = capture->first; d < capture->first + capture->width; ++d )
+        {
+            value = value * 10 + state->digit[d];
+        }
+        match->value[ capture->slot ] = value;
+        match->captured |= 1 << capture->slot;
+    }
+    return 1;
+}
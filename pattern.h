@@ -0,0 +1,41 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_PATTERN_H
+#define DVR2PLEX_PATTERN_H
+
+/* the numeric fields a pattern can capture */
+typedef enum {
+    kCaptureSeason = 0,
+    kCaptureEpisode,
+    kCaptureYear,
+    kCaptureMonth,
+    kCaptureDay,
+    kCaptureCount
+} tCapture;
+
+/* no pattern contains more digits than this */
+#define kMaxPatternDigits   16
+
+typedef struct {
+    unsigned int  state;
+    unsigned int  digits;
+    unsigned char digit[ kMaxPatternDigits ];
+} tPatternState;
+
+typedef struct {
+    tHash         id;
+    unsigned int  captured;     // bitmask of (1 << tCapture)
+    unsigned int  value[ kCaptureCount ];
+} tPatternMatch;
+
+ int  addPattern( string spec, tHash id );
+ int  compilePatterns( void );
+void  releasePatterns( void );
+
+void  resetPattern( tPatternState * state );
+void  stepPattern( tPatternState * state, unsigned char c );
+ int  acceptPattern( const tPatternState * state, tPatternMatch * match );
+
+#endif // DVR2PLEX_PATTERN_H
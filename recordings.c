@@ -0,0 +1,486 @@
+//
+// Created by paul on 10/19/26.
+//
+// Read the recordings from a Channels DVR JSON export, i.e. the array that
+// /dvr/files returns (or one recording object per line). Channels already
+// knows the series, season, episode and so on of each recording, so there's
+// no need to work them out from the filename.
+//
+// The parser streams through the input, and only the few fields we want are
+// kept, decoded directly into a single tRecording that's reused for every
+// recording, so nothing is allocated per recording. The rest is skipped
+// without being stored. Each recording is handed to the callback as soon
+// as its closing brace is reached.
+//
+#define _XOPEN_SOURCE 700
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "recordings.h"
+
+#define kReadSize   65536
+#define kMaxDepth   64
+
+/* what an object is, so we know which of its members to keep */
+typedef enum {
+    kObjectOther,
+    kObjectRecording,
+    kObjectAiring
+} tObjectKind;
+
+typedef struct {
+    FILE             * input;
+    unsigned char      buffer[ kReadSize ];
+    size_t             length;
+    size_t             position;
+    unsigned long      line;
+    tRecording         recording;
+    tRecordingCallback callback;
+    void             * context;
+} tReader;
+
+static int peekChar( tReader * reader )
+{
+    if ( reader->position == reader->length )
+    {
+        reader->length   = fread( reader->buffer, 1, sizeof(reader->buffer), reader->input );
+        reader->position = 0;
+        if ( reader->length == 0 )
+        {
+            return EOF;
+        }
+    }
+    return reader->buffer[ reader->position ];
+}
+
+static int nextChar( tReader * reader )
+{
+    int c = peekChar( reader );
+    if ( c != EOF )
+    {
+        ++reader->position;
+        if ( c == '\n' )
+        {
+            ++reader->line;
+        }
+    }
+    return c;
+}
+
+/* returns the next character that isn't white space, without consuming it */
+static int skipSpace( tReader * reader )
+{
+    int c = peekChar( reader );
+    while ( c == ' ' || c == '\t' || c == '\n' || c == '\r' )
+    {
+        nextChar( reader );
+        c = peekChar( reader );
+    }
+    return c;
+}
+
+static int syntaxError( tReader * reader, string expected )
+{
+    fprintf( stderr, "### Error: expected %s on line %lu of the recordings\n", expected, reader->line );
+    return -1;
+}
+
+static void storeChar( char * into, size_t size, size_t * length, unsigned int c )
+{
+    if ( into != NULL && *length + 1 < size )
+    {
+        into[ (*length)++ ] = (char)c;
+    }
+}
+
+static int hexDigits( tReader * reader, unsigned int * value )
+{
+    *value = 0;
+    for ( int i = 0; i < 4; ++i )
+    {
+        int c = nextChar( reader );
+        if      ( c >= '0' && c <= '9' ) *value = *value * 16 + ( c - '0' );
+        else if ( c >= 'a' && c <= 'f' ) *value = *value * 16 + ( c - 'a' + 10 );
+        else if ( c >= 'A' && c <= 'F' ) *value = *value * 16 + ( c - 'A' + 10 );
+        else return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief read a string (the opening quote has been consumed), decoding it into
+ *        'into' if it's not NULL. Anything that doesn't fit is dropped.
+ */
+static int readString( tReader * reader, char * into, size_t size )
+{
+    size_t length = 0;
+    int    c;
+
+    while ( (c = nextChar( reader )) != '"' )
+    {
+        if ( c == EOF )
+        {
+            return syntaxError( reader, "a closing quote" );
+        }
+        if ( c != '\\' )
+        {
+            storeChar( into, size, &length, c );
+            continue;
+        }
+
+        unsigned int code;
+        switch ( c = nextChar( reader ) )
+        {
+        case 'b': storeChar( into, size, &length, '\b' ); break;
+        case 'f': storeChar( into, size, &length, '\f' ); break;
+        case 'n': storeChar( into, size, &length, '\n' ); break;
+        case 'r': storeChar( into, size, &length, '\r' ); break;
+        case 't': storeChar( into, size, &length, '\t' ); break;
+
+        case 'u':
+            if ( hexDigits( reader, &code ) != 0 )
+            {
+                return syntaxError( reader, "four hex digits" );
+            }
+            if ( code >= 0xD800 && code < 0xDC00 )
+            {
+                // the first half of a surrogate pair, so there should be a second
+                unsigned int low;
+                if ( nextChar( reader ) != '\\' || nextChar( reader ) != 'u'
+                  || hexDigits( reader, &low ) != 0 || low < 0xDC00 || low >= 0xE000 )
+                {
+                    return syntaxError( reader, "the rest of a surrogate pair" );
+                }
+                code = 0x10000 + ( ( code - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+            }
+            if ( code < 0x80 )
+            {
+                storeChar( into, size, &length, code );
+            }
+            else if ( code < 0x800 )
+            {
+                storeChar( into, size, &length, 0xC0 | ( code >> 6 ) );
+                storeChar( into, size, &length, 0x80 | ( code & 0x3F ) );
+            }
+            else if ( code < 0x10000 )
+            {
+                storeChar( into, size, &length, 0xE0 | ( code >> 12 ) );
+                storeChar( into, size, &length, 0x80 | ( ( code >> 6 ) & 0x3F ) );
+                storeChar( into, size, &length, 0x80 | ( code & 0x3F ) );
+            }
+            else
+            {
+                storeChar( into, size, &length, 0xF0 | ( code >> 18 ) );
+                storeChar( into, size, &length, 0x80 | ( ( code >> 12 ) & 0x3F ) );
+                storeChar( into, size, &length, 0x80 | ( ( code >> 6 ) & 0x3F ) );
+                storeChar( into, size, &length, 0x80 | ( code & 0x3F ) );
+            }
+            break;
+
+        case EOF:
+            return syntaxError( reader, "a closing quote" );
+
+        default:    // \" \\ \/
+            storeChar( into, size, &length, c );
+            break;
+        }
+    }
+
+    if ( into != NULL && size > 0 )
+    {
+        into[ length ] = '\0';
+    }
+    return 0;
+}
+
+/**
+ * @brief read a number, true, false or null, keeping its text in 'into' if it's not NULL
+ */
+static int readScalar( tReader * reader, char * into, size_t size )
+{
+    size_t length = 0;
+    size_t read   = 0;
+    int    c = peekChar( reader );
+
+    while ( c != EOF && c != ',' && c != '}' && c != ']'
+         && c != ' ' && c != '\t' && c != '\n' && c != '\r' )
+    {
+        storeChar( into, size, &length, nextChar( reader ) );
+        ++read;
+        c = peekChar( reader );
+    }
+    if ( read == 0 )
+    {
+        return syntaxError( reader, "a value" );
+    }
+    if ( into != NULL && size > 0 )
+    {
+        into[ length ] = '\0';
+    }
+    return 0;
+}
+
+static int readValue( tReader * reader, int depth, tObjectKind kind, char * into, size_t size );
+
+static void startRecording( tRecording * recording )
+{
+    recording->path[0]       = '\0';
+    recording->series[0]     = '\0';
+    recording->title[0]      = '\0';
+    recording->firstAired[0] = '\0';
+    recording->recorded[0]   = '\0';
+    recording->season        = 0;
+    recording->episode       = 0;
+    recording->deleted       = 0;
+}
+
+/* CreatedAt is in milliseconds since the epoch. Make it look like the date in a Channels filename */
+static void storeRecorded( tRecording * recording, string milliseconds )
+{
+    struct tm local;
+    time_t    created = (time_t)( strtoll( milliseconds, NULL, 10 ) / 1000 );
+
+    if ( created > 0 && localtime_r( &created, &local ) != NULL )
+    {
+        strftime( recording->recorded, sizeof(recording->recorded), "%Y-%m-%d-%H%M", &local );
+    }
+}
+
+/**
+ * @brief read the members of an object (the opening brace has been consumed),
+ *        keeping the ones we want from a recording and its airing
+ */
+static int readObject( tReader * reader, int depth, tObjectKind kind )
+{
+    tRecording * recording = &reader->recording;
+    char         key[ 32 ];
+    char         scalar[ 32 ];
+
+    if ( kind == kObjectRecording )
+    {
+        startRecording( recording );
+    }
+
+    int c = skipSpace( reader );
+    if ( c == '}' )
+    {
+        nextChar( reader );
+    }
+    else for (;;)
+    {
+        if ( nextChar( reader ) != '"' )
+        {
+            return syntaxError( reader, "a member name" );
+        }
+        if ( readString( reader, key, sizeof(key) ) != 0 )
+        {
+            return -1;
+        }
+        if ( skipSpace( reader ) != ':' )
+        {
+            return syntaxError( reader, "\':\'" );
+        }
+        nextChar( reader );
+
+        int result = 0;
+        if ( kind == kObjectRecording && strcmp( key, "Path" ) == 0 )
+        {
+            result = readValue( reader, depth, kObjectOther, recording->path, sizeof(recording->path) );
+        }
+        else if ( kind == kObjectRecording && strcmp( key, "Airing" ) == 0 )
+        {
+            result = readValue( reader, depth, kObjectAiring, NULL, 0 );
+        }
+        else if ( kind == kObjectRecording && strcmp( key, "CreatedAt" ) == 0 )
+        {
+            result = readValue( reader, depth, kObjectOther, scalar, sizeof(scalar) );
+            storeRecorded( recording, scalar );
+        }
+        else if ( kind == kObjectRecording && ( strcmp( key, "Deleted" ) == 0 || strcmp( key, "Trashed" ) == 0 ) )
+        {
+            result = readValue( reader, depth, kObjectOther, scalar, sizeof(scalar) );
+            recording->deleted |= ( strcmp( scalar, "true" ) == 0 );
+        }
+        else if ( kind == kObjectAiring && strcmp( key, "Title" ) == 0 )
+        {
+            result = readValue( reader, depth, kObjectOther, recording->series, sizeof(recording->series) );
+        }
+        else if ( kind == kObjectAiring && strcmp( key, "EpisodeTitle" ) == 0 )
+        {
+            result = readValue( reader, depth, kObjectOther, recording->title, sizeof(recording->title) );
+        }
+        else if ( kind == kObjectAiring && strcmp( key, "OriginalDate" ) == 0 )
+        {
+            result = readValue( reader, depth, kObjectOther, recording->firstAired, sizeof(recording->firstAired) );
+        }
+        else if ( kind == kObjectAiring && strcmp( key, "SeasonNumber" ) == 0 )
+        {
+            result = readValue( reader, depth, kObjectOther, scalar, sizeof(scalar) );
+            recording->season = (unsigned int)strtoul( scalar, NULL, 10 );
+        }
+        else if ( kind == kObjectAiring && strcmp( key, "EpisodeNumber" ) == 0 )
+        {
+            result = readValue( reader, depth, kObjectOther, scalar, sizeof(scalar) );
+            recording->episode = (unsigned int)strtoul( scalar, NULL, 10 );
+        }
+        else
+        {
+            result = readValue( reader, depth, kObjectOther, NULL, 0 );
+        }
+        if ( result != 0 )
+        {
+            return result;
+        }
+
+        c = skipSpace( reader );
+        nextChar( reader );
+        if ( c == '}' )
+        {
+            break;
+        }
+        if ( c != ',' )
+        {
+            return syntaxError( reader, "\',\' or \'}\'" );
+        }
+        skipSpace( reader );
+    }
+
+    if ( kind == kObjectRecording && recording->path[0] != '\0' )
+    {
+        reader->callback( reader->context, recording );
+    }
+    return 0;
+}
+
+/**
+ * @brief read any value. If it's an object, 'kind' says what it is. If it's
+ *        a string or scalar, it's kept in 'into' if that's not NULL
+ */
+static int readValue( tReader * reader, int depth, tObjectKind kind, char * into, size_t size )
+{
+    if ( depth >= kMaxDepth )
+    {
+        return syntaxError( reader, "less nesting" );
+    }
+    if ( into != NULL && size > 0 )
+    {
+        into[0] = '\0';
+    }
+
+    int c = skipSpace( reader );
+    switch ( c )
+    {
+    case '{':
+        nextChar( reader );
+        return readObject( reader, depth + 1, kind );
+
+    case '[':
+        nextChar( reader );
+        if ( skipSpace( reader ) == ']' )
+        {
+            nextChar( reader );
+            return 0;
+        }
+        for (;;)
+        {
+            if ( readValue( reader, depth + 1, kObjectOther, NULL, 0 ) != 0 )
+            {
+                return -1;
+            }
+            c = skipSpace( reader );
+            nextChar( reader );
+            if ( c == ']' )
+            {
+                return 0;
+            }
+            if ( c != ',' )
+            {
+                return syntaxError( reader, "\',\' or \']\'" );
+            }
+        }
+
+    case '"':
+        nextChar( reader );
+        return readString( reader, into, size );
+
+    case EOF:
+        return syntaxError( reader, "a value" );
+
+    default:
+        if ( readScalar( reader, into, size ) != 0 )
+        {
+            return -1;
+        }
+        if ( into != NULL && strcmp( into, "null" ) == 0 )
+        {
+            into[0] = '\0';   // the same as not being there at all
+        }
+        return 0;
+    }
+}
+
+/**
+ * @brief call 'callback' for each recording in 'input', which is either an array
+ *        of recordings, or a series of recording objects (e.g. one per line)
+ */
+int readRecordings( FILE * input, tRecordingCallback callback, void * context )
+{
+    int result = 0;
+
+    tReader * reader = malloc( sizeof(tReader) );
+    if ( reader == NULL )
+    {
+        return -1;
+    }
+    reader->input    = input;
+    reader->length   = 0;
+    reader->position = 0;
+    reader->line     = 1;
+    reader->callback = callback;
+    reader->context  = context;
+
+    int c;
+    while ( result == 0 && (c = skipSpace( reader )) != EOF )
+    {
+        nextChar( reader );
+        if ( c == '{' )
+        {
+            result = readObject( reader, 1, kObjectRecording );
+        }
+        else if ( c == '[' )
+        {
+            // the elements of the outermost array are the recordings
+            if ( skipSpace( reader ) == ']' )
+            {
+                nextChar( reader );
+                continue;
+            }
+            do {
+                if ( skipSpace( reader ) != '{' )
+                {
+                    result = syntaxError( reader, "a recording" );
+                    break;
+                }
+                nextChar( reader );
+                result = readObject( reader, 2, kObjectRecording );
+                c = skipSpace( reader );
+                nextChar( reader );
+            } while ( result == 0 && c == ',' );
+
+            if ( result == 0 && c != ']' )
+            {
+                result = syntaxError( reader, "\',\' or \']\'" );
+            }
+        }
+        else
+        {
+            result = syntaxError( reader, "a recording, or an array of them" );
+        }
+    }
+
+    free( reader );
+    return result;
+}
@@ -0,0 +1,28 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_RECORDINGS_H
+#define DVR2PLEX_RECORDINGS_H
+
+#include <limits.h>
+#include <stdio.h>
+
+/* what Channels DVR knows about a recording. Strings are empty if it wasn't given */
+typedef struct {
+    char          path[ PATH_MAX ];
+    char          series[ 256 ];      // Airing.Title
+    char          title[ 256 ];       // Airing.EpisodeTitle
+    char          firstAired[ 32 ];   // Airing.OriginalDate
+    char          recorded[ 32 ];     // CreatedAt, as YYYY-MM-DD-HHMM
+    unsigned int  season;             // Airing.SeasonNumber, 0 if unknown
+    unsigned int  episode;            // Airing.EpisodeNumber, 0 if unknown
+    int           deleted;            // Deleted or Trashed
+} tRecording;
+
+/* the recording's strings may be modified, but only remain valid until the callback returns */
+typedef void (* tRecordingCallback)( void * context, tRecording * recording );
+
+int readRecordings( FILE * input, tRecordingCallback callback, void * context );
+
+#endif // DVR2PLEX_RECORDINGS_H
@@ -0,0 +1,230 @@
+//
+// Created by paul on 10/19/26.
+//
+// Immutable snapshots, rebuilt in the background. A watcher thread calls
+// the build callback every 'interval' seconds, and if it returns a new
+// snapshot, publishes it with an atomic pointer swap. Readers never wait
+// for a rebuild, they just pick up whichever snapshot is current.
+//
+// The snapshot that was replaced can't be released until no reader could
+// still be using it. Each reader thread has a slot holding the epoch it
+// last saw. snapshotAcquire() returns the epoch it read along with the
+// snapshot, and once the thread has finished with whatever it acquired
+// before, it passes that epoch to snapshotQuiesce() (i.e. a quiescent
+// state, in RCU terms). Until then the older snapshot stays protected, so
+// a reader can still compare it with the new one. A replaced snapshot is retired with the epoch that was
+// current after the swap, and released by the watcher once every reader
+// has seen that epoch or a later one.
+//
+#define _XOPEN_SOURCE 700
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "snapshot.h"
+
+#define kSnapshotReaders 8
+
+typedef struct sRetired {
+    struct sRetired * next;
+    void            * snapshot;
+    unsigned long     epoch;    // safe to release once every reader has seen this epoch
+} tRetired;
+
+static _Atomic(void *)        gCurrent = NULL;
+static atomic_ulong           gEpoch   = 1;
+static atomic_ulong           gSeen[ kSnapshotReaders ];  // zero if the slot is unused
+static _Thread_local int      gSlot    = -1;
+
+static tRetired             * gRetired = NULL;   // only touched by the watcher, until it's stopped
+static tSnapshotBuild         gBuild   = NULL;
+static tSnapshotRelease       gRelease = NULL;
+static unsigned int           gInterval;
+static pthread_t              gWatcher;
+static int                    gRunning = 0;
+static pthread_mutex_t        gStopMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t         gStopCond  = PTHREAD_COND_INITIALIZER;
+static int                    gStop    = 0;
+
+/**
+ * @brief release the retired snapshots that no reader can still be using
+ */
+static void reclaim( void )
+{
+    unsigned long oldest = ~0UL;
+
+    for ( unsigned int i = 0; i < kSnapshotReaders; ++i )
+    {
+        unsigned long seen = atomic_load( &gSeen[i] );
+        if ( seen != 0 && seen < oldest )
+        {
+            oldest = seen;
+        }
+    }
+
+    tRetired ** link = &gRetired;
+    while ( *link != NULL )
+    {
+        tRetired * retired = *link;
+        if ( retired->epoch <= oldest )
+        {
+            *link = retired->next;
+            gRelease( retired->snapshot );
+            free( retired );
+        }
+        else
+        {
+            link = &retired->next;
+        }
+    }
+}
+
+static void publish( void * snapshot )
+{
+    tRetired * retired = malloc( sizeof(tRetired) );
+    if ( retired == NULL )
+    {
+        gRelease( snapshot );   // the old one couldn't be retired safely, so stay with it
+        return;
+    }
+
+    retired->snapshot = atomic_exchange( &gCurrent, snapshot );
+    retired->epoch    = atomic_fetch_add( &gEpoch, 1 ) + 1;
+    retired->next     = gRetired;
+    gRetired = retired;
+}
+
+static void * watchThread( void * unused )
+{
+    (void)unused;
+
+    pthread_mutex_lock( &gStopMutex );
+    while ( !gStop )
+    {
+        struct timespec wake;
+        clock_gettime( CLOCK_REALTIME, &wake );
+        wake.tv_sec += gInterval;
+        pthread_cond_timedwait( &gStopCond, &gStopMutex, &wake );
+        if ( gStop )
+        {
+            break;
+        }
+        pthread_mutex_unlock( &gStopMutex );
+
+        void * snapshot = gBuild( atomic_load( &gCurrent ) );
+        if ( snapshot != NULL )
+        {
+            debugf( 2, "%s\n", "publishing a new snapshot" );
+            publish( snapshot );
+        }
+        reclaim();
+
+        pthread_mutex_lock( &gStopMutex );
+    }
+    pthread_mutex_unlock( &gStopMutex );
+    return NULL;
+}
+
+/**
+ * @brief make 'initial' the current snapshot, and start checking for a new one every 'interval' seconds
+ */
+int snapshotOpen( void * initial, unsigned int interval, tSnapshotBuild build, tSnapshotRelease release )
+{
+    atomic_store( &gCurrent, initial );
+    gBuild    = build;
+    gRelease  = release;
+    gInterval = ( interval > 0 ) ? interval : 1;
+    gStop     = 0;
+
+    int error = pthread_create( &gWatcher, NULL, watchThread, NULL );
+    if ( error != 0 )
+    {
+        fprintf( stderr, "### Error: unable to start watching for changes (%d: %s)\n",
+                 error, strerror( error ) );
+        return -1;
+    }
+    gRunning = 1;
+    return 0;
+}
+
+/**
+ * @brief the current snapshot, and the epoch to hand to snapshotQuiesce() once the
+ *        calling thread is done with the snapshot it acquired before this one
+ */
+void * snapshotAcquire( unsigned long * epoch )
+{
+    *epoch = atomic_load( &gEpoch );
+
+    if ( gSlot < 0 )
+    {
+        // nothing acquired before, so this thread is already quiescent
+        for ( int i = 0; i < kSnapshotReaders && gSlot < 0; ++i )
+        {
+            unsigned long unused = 0;
+            if ( atomic_compare_exchange_strong( &gSeen[i], &unused, *epoch ) )
+            {
+                gSlot = i;
+            }
+        }
+        if ( gSlot < 0 )
+        {
+            fprintf( stderr, "### Error: too many threads reading snapshots\n" );
+            abort();
+        }
+    }
+
+    // loaded after the epoch, so it can't be older than that epoch's snapshot
+    return atomic_load( &gCurrent );
+}
+
+/**
+ * @brief declare that the calling thread no longer uses any snapshot acquired before the one
+ *        that came with 'epoch', so they can be released
+ */
+void snapshotQuiesce( unsigned long epoch )
+{
+    if ( gSlot >= 0 )
+    {
+        atomic_store( &gSeen[ gSlot ], epoch );
+    }
+}
+
+/**
+ * @brief stop watching, and release every snapshot. No thread may use a snapshot after this
+ */
+void snapshotClose( void )
+{
+    if ( gRunning )
+    {
+        pthread_mutex_lock( &gStopMutex );
+        gStop = 1;
+        pthread_cond_signal( &gStopCond );
+        pthread_mutex_unlock( &gStopMutex );
+        pthread_join( gWatcher, NULL );
+        gRunning = 0;
+    }
+
+    while ( gRetired != NULL )
+    {
+        tRetired * next = gRetired->next;
+        gRelease( gRetired->snapshot );
+        free( gRetired );
+        gRetired = next;
+    }
+
+    void * current = atomic_exchange( &gCurrent, NULL );
+    if ( current != NULL )
+    {
+        gRelease( current );
+    }
+    for ( unsigned int i = 0; i < kSnapshotReaders; ++i )
+    {
+        atomic_store( &gSeen[i], 0 );
+    }
+    gSlot = -1;
+}
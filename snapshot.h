@@ -0,0 +1,18 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_SNAPSHOT_H
+#define DVR2PLEX_SNAPSHOT_H
+
+/* called on the watcher thread with the current snapshot. Returns its
+   replacement, or NULL if nothing has changed since it was built */
+typedef void * (* tSnapshotBuild)( void * current );
+typedef void   (* tSnapshotRelease)( void * snapshot );
+
+  int  snapshotOpen( void * initial, unsigned int interval, tSnapshotBuild build, tSnapshotRelease release );
+void * snapshotAcquire( unsigned long * epoch );
+ void  snapshotQuiesce( unsigned long epoch );
+ void  snapshotClose( void );
+
+#endif // DVR2PLEX_SNAPSHOT_H
@@ -0,0 +1,219 @@
+//
+// Created by paul on 10/19/26.
+//
+// Timeline of where the time goes, in the Chrome trace event format (which
+// both chrome://tracing and ui.perfetto.dev will load). Events are only
+// collected in memory while running, and are written to the trace file when
+// it's closed at exit, so tracing doesn't add any I/O of its own to the
+// timeline it is recording.
+//
+#define _GNU_SOURCE
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+typedef struct {
+    string   name;      // always a string literal, so not copied
+    string   detail;    // copied, may be NULL
+    uint64_t timestamp; // microseconds
+    pid_t    thread;
+    char     phase;     // 'B'egin, 'E'nd or 'i'nstant
+} tTraceEvent;
+
+static string          gTracePath   = NULL;
+static tTraceEvent   * gTraceEvents = NULL;
+static size_t          gTraceCount  = 0;
+static size_t          gTraceSize   = 0;
+static uint64_t        gTraceStart  = 0;
+static pthread_mutex_t gTraceMutex  = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int      gTracing     = 0;    // so not tracing doesn't cost a lock
+
+static uint64_t traceClock( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void traceEvent( char phase, string name, string detail )
+{
+    if ( !atomic_load_explicit( &gTracing, memory_order_relaxed ) )
+    {
+        return;
+    }
+
+    uint64_t timestamp = traceClock();
+    pid_t    thread    = (pid_t)syscall( SYS_gettid );
+
+    pthread_mutex_lock( &gTraceMutex );
+    if ( gTracePath == NULL )
+    {
+        pthread_mutex_unlock( &gTraceMutex );
+        return;
+    }
+    if ( gTraceCount >= gTraceSize )
+    {
+        size_t size = ( gTraceSize == 0 ) ? 4096 : gTraceSize * 2;
+        tTraceEvent * events = realloc( gTraceEvents, size * sizeof(tTraceEvent) );
+        if ( events == NULL )
+        {
+            pthread_mutex_unlock( &gTraceMutex );
+            return;   // lose the event rather than the run
+        }
+        gTraceEvents = events;
+        gTraceSize   = size;
+    }
+
+    tTraceEvent * event = &gTraceEvents[ gTraceCount++ ];
+    event->name      = name;
+    event->detail    = ( detail != NULL ) ? strdup( detail ) : NULL;
+    event->timestamp = timestamp - gTraceStart;
+    event->thread    = thread;
+    event->phase     = phase;
+    pthread_mutex_unlock( &gTraceMutex );
+}
+
+/**
+ * @brief start collecting trace events, to be written to 'path' by traceClose()
+ */
+int traceOpen( string path )
+{
+    pthread_mutex_lock( &gTraceMutex );
+    if ( gTracePath == NULL )
+    {
+        gTraceStart = traceClock();
+        gTracePath  = strdup( path );
+        atomic_store( &gTracing, gTracePath != NULL );
+    }
+    pthread_mutex_unlock( &gTraceMutex );
+    return 0;
+}
+
+void traceBegin( string name, string detail )
+{
+    traceEvent( 'B', name, detail );
+}
+
+void traceEnd( string name )
+{
+    traceEvent( 'E', name, NULL );
+}
+
+void traceInstant( string name, string detail )
+{
+    traceEvent( 'i', name, detail );
+}
+
+static void writeJSONString( FILE * file, string s )
+{
+    fputc( '"', file );
+    for ( ; *s != '\0'; s++ )
+    {
+        unsigned char c = (unsigned char)*s;
+        switch ( c )
+        {
+        case '"':  fputs( "\\\"", file ); break;
+        case '\\': fputs( "\\\\", file ); break;
+        case '\n': fputs( "\\n",  file ); break;
+        case '\t': fputs( "\\t",  file ); break;
+        default:
+            if ( c < 0x20 )
+            {
+                fprintf( file, "\\u%04x", c );
+            }
+            else
+            {
+                fputc( c, file );
+            }
+            break;
+        }
+    }
+    fputc( '"', file );
+}
+
+/**
+ * @brief write out all the events collected so far, and stop tracing
+ */
+int traceClose( void )
+{
+    int result = 0;
+
+    // take the events away from any thread still tracing, which from now on is ignored
+    pthread_mutex_lock( &gTraceMutex );
+    string        path   = gTracePath;
+    tTraceEvent * events = gTraceEvents;
+    size_t        count  = gTraceCount;
+    atomic_store( &gTracing, 0 );
+    gTracePath   = NULL;
+    gTraceEvents = NULL;
+    gTraceCount  = 0;
+    gTraceSize   = 0;
+    pthread_mutex_unlock( &gTraceMutex );
+
+    if ( path == NULL )
+    {
+        return 0;
+    }
+
+    FILE * file = fopen( path, "w" );
+    if ( file == NULL )
+    {
+        fprintf( stderr, "### Error: Unable to create trace file \'%s\' (%d: %s)\n",
+                 path, errno, strerror(errno) );
+        result = errno;
+    }
+    else
+    {
+        pid_t pid = getpid();
+
+        fprintf( file, "{\"traceEvents\":[\n" );
+        for ( size_t i = 0; i < count; ++i )
+        {
+            tTraceEvent * event = &events[ i ];
+
+            fprintf( file, "{\"name\":" );
+            writeJSONString( file, event->name );
+            fprintf( file, ",\"cat\":\"dvr2plex\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%d,\"tid\":%d",
+                     event->phase, (unsigned long long)event->timestamp, pid, event->thread );
+            if ( event->phase == 'i' )
+            {
+                fprintf( file, ",\"s\":\"t\"" );
+            }
+            if ( event->detail != NULL )
+            {
+                fprintf( file, ",\"args\":{\"detail\":" );
+                writeJSONString( file, event->detail );
+                fputc( '}', file );
+            }
+            fprintf( file, "}%s\n", ( i + 1 < count ) ? "," : "" );
+        }
+        fprintf( file, "],\"displayTimeUnit\":\"ms\"}\n" );
+
+        if ( fclose( file ) != 0 )
+        {
+            fprintf( stderr, "### Error: Unable to write trace file \'%s\' (%d: %s)\n",
+                     path, errno, strerror(errno) );
+            result = errno;
+        }
+    }
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+        free( (void *)events[ i ].detail );
+    }
+    free( events );
+    free( (void *)path );
+
+    return result;
+}
@@ -0,0 +1,14 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_TRACE_H
+#define DVR2PLEX_TRACE_H
+
+int  traceOpen( string path );
+void traceBegin( string name, string detail );
+void traceEnd( string name );
+void traceInstant( string name, string detail );
+int  traceClose( void );
+
+#endif // DVR2PLEX_TRACE_H
@@ -0,0 +1,373 @@
+//
+// Created by paul on 10/19/26.
+//
+// Approximate matching of names, in the style of SymSpell. Every name added
+// is stored along with each string that can be made from it by deleting up
+// to 'distance' characters. A query generates the same deletions of itself,
+// and any name that shares one of them is a candidate, whose actual edit
+// distance is then checked. Two strings within edit distance d of each other
+// always share a string made by at most d deletions from each, so no match
+// is missed, and the cost of a query depends on the length of the query
+// rather than on how many names there are.
+//
+// The names are expected to be normalised by the caller already (e.g. case
+// folded, separators removed), so they're compared byte by byte.
+//
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+
+#include "typoindex.h"
+
+/* there are a lot of these, so they're kept small. A name whose deletion
+   happens to hash the same as the query's is only one more to check */
+typedef struct {
+    uint32_t     hash;      // of the deletion
+    uint32_t     key;       // the name it was made from, plus one (zero if unused)
+} tTypoEntry;
+
+struct sTypoIndex {
+    unsigned int distance;
+    tTypoEntry * table;
+    size_t       count;
+    size_t       size;      // always a power of two
+    char      ** keys;
+    unsigned int * ids;
+    unsigned int keyCount;
+    unsigned int keySize;
+};
+
+/* called for each deletion of a string, until it returns non-zero */
+typedef int (* tDeletionCallback)( void * context, uint32_t hash );
+
+static uint32_t hashTypo( string s, size_t length )
+{
+    uint64_t h = 0xcbf29ce484222325ULL;    // FNV-1a
+
+    for ( size_t i = 0; i < length; ++i )
+    {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return (uint32_t)( h ^ ( h >> 32 ) );
+}
+
+static size_t typoSlot( const tTypoIndex * index, uint32_t hash )
+{
+    return (size_t)( hash * 0x9E3779B1U >> 8 ) & ( index->size - 1 );
+}
+
+/**
+ * @brief call 'callback' for 's' and every string made by deleting up to 'remaining'
+ *        characters from it, deleting only at 'from' onwards (so each set of deletions
+ *        is only made once, though different sets may still make the same string)
+ */
+static int forEachDeletion( string s, size_t length, size_t from, unsigned int remaining,
+                            tDeletionCallback callback, void * context )
+{
+    char shorter[ kMaxTypoKey ];
+
+    if ( callback( context, hashTypo( s, length ) ) != 0 )
+    {
+        return 1;
+    }
+    if ( remaining == 0 || length <= 1 )
+    {
+        return 0;
+    }
+    for ( size_t i = from; i < length; ++i )
+    {
+        memcpy( shorter, s, i );
+        memcpy( shorter + i, s + i + 1, length - i - 1 );
+        if ( forEachDeletion( shorter, length - 1, i, remaining - 1, callback, context ) != 0 )
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief edit distance between 'a' and 'b', counting a transposition as one edit
+ *        (optimal string alignment), or 'limit' + 1 if it's more than 'limit'
+ */
+static unsigned int typoDistance( string a, size_t aLength, string b, size_t bLength, unsigned int limit )
+{
+    unsigned int rows[3][ kMaxTypoKey + 1 ];
+    unsigned int * previous2 = rows[0];
+    unsigned int * previous  = rows[1];
+    unsigned int * current   = rows[2];
+
+    if ( ( aLength > bLength ? aLength - bLength : bLength - aLength ) > limit )
+    {
+        return limit + 1;
+    }
+
+    for ( size_t j = 0; j <= bLength; ++j )
+    {
+        previous[j] = j;
+    }
+    for ( size_t i = 1; i <= aLength; ++i )
+    {
+        unsigned int best = current[0] = i;
+        for ( size_t j = 1; j <= bLength; ++j )
+        {
+            unsigned int cost = ( a[ i - 1 ] == b[ j - 1 ] ) ? 0 : 1;
+            unsigned int d    = previous[ j - 1 ] + cost;
+
+            if ( previous[j] + 1 < d )
+            {
+                d = previous[j] + 1;
+            }
+            if ( current[ j - 1 ] + 1 < d )
+            {
+                d = current[ j - 1 ] + 1;
+            }
+            if ( i > 1 && j > 1 && a[ i - 1 ] == b[ j - 2 ] && a[ i - 2 ] == b[ j - 1 ]
+              && previous2[ j - 2 ] + 1 < d )
+            {
+                d = previous2[ j - 2 ] + 1;
+            }
+            current[j] = d;
+            if ( d < best )
+            {
+                best = d;
+            }
+        }
+        if ( best > limit )
+        {
+            return limit + 1;
+        }
+        unsigned int * oldest = previous2;
+        previous2 = previous;
+        previous  = current;
+        current   = oldest;
+    }
+    return ( previous[ bLength ] <= limit ) ? previous[ bLength ] : limit + 1;
+}
+
+static int growTypoTable( tTypoIndex * index )
+{
+    tTypoEntry * old  = index->table;
+    size_t       size = index->size;
+
+    index->size  = ( size == 0 ) ? 1024 : size * 2;
+    index->table = calloc( index->size, sizeof(tTypoEntry) );
+    if ( index->table == NULL )
+    {
+        fprintf( stderr, "### Error: unable to allocate memory for typo index (%d: %s)\n",
+                 errno, strerror(errno) );
+        index->table = old;
+        index->size  = size;
+        return -1;
+    }
+    for ( size_t i = 0; i < size; ++i )
+    {
+        if ( old[i].key != 0 )
+        {
+            size_t slot = typoSlot( index, old[i].hash );
+            while ( index->table[ slot ].key != 0 )
+            {
+                slot = ( slot + 1 ) & ( index->size - 1 );
+            }
+            index->table[ slot ] = old[i];
+        }
+    }
+    free( old );
+    return 0;
+}
+
+typedef struct {
+    tTypoIndex * index;
+    uint32_t     key;
+} tInsert;
+
+static int insertDeletion( void * context, uint32_t hash )
+{
+    tInsert    * insert = context;
+    tTypoIndex * index  = insert->index;
+
+    // keep the table no more than half full
+    if ( ( index->count + 1 ) * 2 > index->size && growTypoTable( index ) != 0 )
+    {
+        return 1;
+    }
+
+    size_t slot = typoSlot( index, hash );
+    while ( index->table[ slot ].key != 0 )
+    {
+        if ( index->table[ slot ].hash == hash && index->table[ slot ].key == insert->key + 1 )
+        {
+            return 0;   // another set of deletions made the same string
+        }
+        slot = ( slot + 1 ) & ( index->size - 1 );
+    }
+    index->table[ slot ].hash = hash;
+    index->table[ slot ].key  = insert->key + 1;
+    ++index->count;
+    return 0;
+}
+
+/* the best candidate so far, and the ones already checked */
+#define kMaxChecked 64
+
+typedef struct {
+    const tTypoIndex * index;
+    string             key;
+    size_t             length;
+    unsigned int       limit;
+    unsigned int       best;     // limit + 1 if nothing has matched yet
+    uint32_t           match;
+    uint32_t           checked[ kMaxChecked ];
+    unsigned int       checkedCount;
+} tQuery;
+
+static int checkDeletion( void * context, uint32_t hash )
+{
+    tQuery           * query = context;
+    const tTypoIndex * index = query->index;
+
+    for ( size_t slot = typoSlot( index, hash ); index->table[ slot ].key != 0; slot = ( slot + 1 ) & ( index->size - 1 ) )
+    {
+        const tTypoEntry * entry = &index->table[ slot ];
+        uint32_t           key   = entry->key - 1;
+        if ( entry->hash != hash )
+        {
+            continue;
+        }
+
+        unsigned int seen = 0;
+        for ( unsigned int i = 0; i < query->checkedCount && !seen; ++i )
+        {
+            seen = ( query->checked[i] == key );
+        }
+        if ( seen )
+        {
+            continue;
+        }
+        if ( query->checkedCount < kMaxChecked )
+        {
+            query->checked[ query->checkedCount++ ] = key;
+        }
+
+        string       candidate = index->keys[ key ];
+        unsigned int distance  = typoDistance( query->key, query->length, candidate, strlen( candidate ), query->limit );
+
+        // the earliest name added wins a tie
+        if ( distance < query->best || ( distance == query->best && key < query->match ) )
+        {
+            query->best  = distance;
+            query->match = key;
+        }
+    }
+    return query->best == 0;
+}
+
+/**
+ * @brief an empty index, for queries of up to 'distance' edits (at most kMaxTypoDistance)
+ */
+tTypoIndex * createTypoIndex( unsigned int distance )
+{
+    tTypoIndex * index = calloc( 1, sizeof(tTypoIndex) );
+
+    if ( index != NULL )
+    {
+        index->distance = ( distance < kMaxTypoDistance ) ? distance : kMaxTypoDistance;
+    }
+    return index;
+}
+
+/**
+ * @brief add a name, which will be identified by 'id' when it matches a query.
+ *        Names longer than kMaxTypoKey are not added
+ */
+int addTypoKey( tTypoIndex * index, string key, unsigned int id )
+{
+    size_t length = strlen( key );
+
+    if ( length == 0 || length > kMaxTypoKey )
+    {
+        return 0;
+    }
+
+    if ( index->keyCount >= index->keySize )
+    {
+        unsigned int size  = ( index->keySize == 0 ) ? 256 : index->keySize * 2;
+        char      ** keys  = realloc( index->keys, size * sizeof(char *) );
+        unsigned int * ids = ( keys != NULL ) ? realloc( index->ids, size * sizeof(unsigned int) ) : NULL;
+        if ( keys != NULL )
+        {
+            index->keys = keys;
+        }
+        if ( ids == NULL )
+        {
+            fprintf( stderr, "### Error: unable to allocate memory for typo index (%d: %s)\n",
+                     errno, strerror(errno) );
+            return -1;
+        }
+        index->ids     = ids;
+        index->keySize = size;
+    }
+
+    char * copy = strdup( key );
+    if ( copy == NULL )
+    {
+        return -1;
+    }
+    index->keys[ index->keyCount ] = copy;
+    index->ids[ index->keyCount ]  = id;
+
+    tInsert insert = { index, index->keyCount };
+    ++index->keyCount;
+    return forEachDeletion( key, length, 0, index->distance, insertDeletion, &insert ) != 0 ? -1 : 0;
+}
+
+/**
+ * @brief find the name closest to the first 'length' characters of 'key', if it's
+ *        within 'distance' edits (and the distance the index was created for)
+ * @return the number of edits, with 'id' set to the name's id, or -1 if none are close enough
+ */
+int findTypoKey( const tTypoIndex * index, string key, size_t length, unsigned int distance, unsigned int * id )
+{
+    tQuery query;
+
+    if ( index == NULL || index->count == 0 || length == 0 || length > kMaxTypoKey )
+    {
+        return -1;
+    }
+
+    memset( &query, 0, sizeof(query) );
+    query.index  = index;
+    query.key    = key;
+    query.length = length;
+    query.limit  = ( distance < index->distance ) ? distance : index->distance;
+    query.best   = query.limit + 1;
+
+    forEachDeletion( key, length, 0, query.limit, checkDeletion, &query );
+
+    if ( query.best > query.limit )
+    {
+        return -1;
+    }
+    *id = index->ids[ query.match ];
+    return (int)query.best;
+}
+
+void destroyTypoIndex( tTypoIndex * index )
+{
+    if ( index == NULL )
+    {
+        return;
+    }
+    for ( unsigned int i = 0; i < index->keyCount; ++i )
+    {
+        free( index->keys[i] );
+    }
+    free( index->keys );
+    free( index->ids );
+    free( index->table );
+    free( index );
+}
@@ -0,0 +1,21 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_TYPOINDEX_H
+#define DVR2PLEX_TYPOINDEX_H
+
+#include <stddef.h>
+
+#define kMaxTypoDistance    2
+#define kMaxTypoKey         64
+
+typedef struct sTypoIndex tTypoIndex;
+
+tTypoIndex * createTypoIndex( unsigned int distance );
+        int  addTypoKey( tTypoIndex * index, string key, unsigned int id );
+        int  findTypoKey( const tTypoIndex * index, string key, size_t length,
+                          unsigned int distance, unsigned int * id );
+       void  destroyTypoIndex( tTypoIndex * index );
+
+#endif // DVR2PLEX_TYPOINDEX_H
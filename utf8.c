@@ -0,0 +1,230 @@
+//
+// Created by paul on 10/19/26.
+//
+// Just enough UTF-8 handling to make names that differ only by accents,
+// full-width forms or 'smart' punctuation hash the same way. Each UTF-8
+// sequence we know about is 'folded' into the ASCII character(s) it most
+// resembles, e.g. 'é' becomes 'e', 'Æ' becomes 'AE', a curly apostrophe
+// becomes a straight one, and a full-width 'Ｓ' becomes 'S'. Anything else
+// is passed through untouched.
+//
+// The vast majority of names are pure ASCII, so isASCII() is used to check
+// for that up front (eight bytes at a time), and those names take the same
+// path they always did.
+//
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "utf8.h"
+
+/*
+   Folds for U+00A0 to U+017F (Latin-1 Supplement and Latin Extended-A).
+   Generated from the Unicode decomposition data (NFKD, with the combining
+   marks removed), plus the letters that have no decomposition (e.g. 'ß',
+   'Ø', 'Ł'). An empty string means the character is left as it is.
+ */
+static const char kLatinFold[ 0x180 - 0xA0 ][3] = {
+    /* U+00A0 */ " ", "", "", "", "", "", "", "",
+    /* U+00A8 */ "", "", "a", "\"", "", "", "", "",
+    /* U+00B0 */ "", "", "2", "3", "'", "", "", ".",
+    /* U+00B8 */ "", "1", "o", "\"", "", "", "", "",
+    /* U+00C0 */ "A", "A", "A", "A", "A", "A", "AE", "C",
+    /* U+00C8 */ "E", "E", "E", "E", "I", "I", "I", "I",
+    /* U+00D0 */ "D", "N", "O", "O", "O", "O", "O", "x",
+    /* U+00D8 */ "O", "U", "U", "U", "U", "Y", "TH", "ss",
+    /* U+00E0 */ "a", "a", "a", "a", "a", "a", "ae", "c",
+    /* U+00E8 */ "e", "e", "e", "e", "i", "i", "i", "i",
+    /* U+00F0 */ "d", "n", "o", "o", "o", "o", "o", "/",
+    /* U+00F8 */ "o", "u", "u", "u", "u", "y", "th", "y",
+    /* U+0100 */ "A", "a", "A", "a", "A", "a", "C", "c",
+    /* U+0108 */ "C", "c", "C", "c", "C", "c", "D", "d",
+    /* U+0110 */ "D", "d", "E", "e", "E", "e", "E", "e",
+    /* U+0118 */ "E", "e", "E", "e", "G", "g", "G", "g",
+    /* U+0120 */ "G", "g", "G", "g", "H", "h", "H", "h",
+    /* U+0128 */ "I", "i", "I", "i", "I", "i", "I", "i",
+    /* U+0130 */ "I", "i", "IJ", "ij", "J", "j", "K", "k",
+    /* U+0138 */ "k", "L", "l", "L", "l", "L", "l", "L",
+    /* U+0140 */ "l", "L", "l", "N", "n", "N", "n", "N",
+    /* U+0148 */ "n", "n", "N", "n", "O", "o", "O", "o",
+    /* U+0150 */ "O", "o", "OE", "oe", "R", "r", "R", "r",
+    /* U+0158 */ "R", "r", "S", "s", "S", "s", "S", "s",
+    /* U+0160 */ "S", "s", "T", "t", "T", "t", "T", "t",
+    /* U+0168 */ "U", "u", "U", "u", "U", "u", "U", "u",
+    /* U+0170 */ "U", "u", "U", "u", "W", "w", "Y", "y",
+    /* U+0178 */ "Y", "Z", "z", "Z", "z", "Z", "z", "s",
+};
+
+/* Folds for U+2000 to U+203F (General Punctuation) */
+static const char kPunctuationFold[ 0x40 ][4] = {
+    /* U+2000 */ " ", " ", " ", " ", " ", " ", " ", " ",
+    /* U+2008 */ " ", " ", " ", "", "", "", "", "",
+    /* U+2010 */ "-", "-", "-", "-", "-", "-", "", "",
+    /* U+2018 */ "'", "'", "'", "'", "\"", "\"", "\"", "\"",
+    /* U+2020 */ "", "", "", "", ".", "..", "...", "",
+    /* U+2028 */ "", "", "", "", "", "", "", " ",
+    /* U+2030 */ "", "", "'", "\"", "", "'", "\"", "",
+    /* U+2038 */ "", "", "", "", "", "", "", "",
+};
+
+/**
+ * @brief check whether the string is pure 7-bit ASCII, eight bytes at a time
+ */
+int isASCII( string s, size_t length )
+{
+    uint64_t bits = 0;
+    size_t   i    = 0;
+
+    for ( ; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t) )
+    {
+        uint64_t word;
+        memcpy( &word, s + i, sizeof(word) );
+        bits |= word;
+    }
+    for ( ; i < length; ++i )
+    {
+        bits |= (unsigned char)s[i];
+    }
+    return ( bits & 0x8080808080808080ULL ) == 0;
+}
+
+/**
+ * @brief decode the UTF-8 sequence at 's', and fold it into ASCII if we can
+ * @param s       the start of the sequence
+ * @param folded  where to put the folded form (not NUL-terminated)
+ * @param length  set to the number of bytes the sequence occupies
+ * @return the number of bytes placed in 'folded'. If the sequence isn't one
+ *         we fold (or isn't valid UTF-8), this is the sequence itself.
+ */
+unsigned int foldUTF8( string s, char folded[4], unsigned int * length )
+{
+    const unsigned char * p = (const unsigned char *)s;
+    unsigned int codepoint;
+    unsigned int count;
+    const char * fold = NULL;
+
+    if ( p[0] < 0x80 )
+    {
+        folded[0] = p[0];
+        *length = 1;
+        return 1;
+    }
+    else if ( (p[0] & 0xE0) == 0xC0 ) { codepoint = p[0] & 0x1F; count = 2; }
+    else if ( (p[0] & 0xF0) == 0xE0 ) { codepoint = p[0] & 0x0F; count = 3; }
+    else if ( (p[0] & 0xF8) == 0xF0 ) { codepoint = p[0] & 0x07; count = 4; }
+    else
+    {
+        // a stray continuation byte, or not UTF-8 at all
+        folded[0] = p[0];
+        *length = 1;
+        return 1;
+    }
+
+    for ( unsigned int i = 1; i < count; ++i )
+    {
+        if ( (p[i] & 0xC0) != 0x80 )
+        {
+            // truncated sequence (this also stops us at a NUL)
+            folded[0] = p[0];
+            *length = 1;
+            return 1;
+        }
+        codepoint = (codepoint << 6) | (p[i] & 0x3F);
+    }
+    *length = count;
+
+    if ( 0xA0 <= codepoint && codepoint < 0x180 )
+    {
+        fold = kLatinFold[ codepoint - 0xA0 ];
+    }
+    else if ( 0x2000 <= codepoint && codepoint < 0x2040 )
+    {
+        fold = kPunctuationFold[ codepoint - 0x2000 ];
+    }
+    else if ( 0xFF01 <= codepoint && codepoint <= 0xFF5E )
+    {
+        // full-width forms of the printable ASCII characters
+        folded[0] = (char)( codepoint - 0xFF01 + '!' );
+        return 1;
+    }
+    else if ( codepoint == 0x3000 )
+    {
+        // ideographic (full-width) space
+        folded[0] = ' ';
+        return 1;
+    }
+
+    if ( fold != NULL && fold[0] != '\0' )
+    {
+        unsigned int n = strlen( fold );
+        memcpy( folded, fold, n );
+        return n;
+    }
+
+    memcpy( folded, s, count );
+    return count;
+}
+
+/**
+ * @brief copy 'src' to 'dst', folding it along the way
+ * @param offsets  if not NULL, for each byte of the output, the offset of the
+ *                 sequence in 'src' it came from (plus one for the terminator)
+ * @return the length of the folded string
+ */
+size_t normalizeUTF8( string src, char * dst, size_t size, unsigned short * offsets )
+{
+    string s = src;
+    size_t i = 0;
+
+    while ( *s != '\0' )
+    {
+        char folded[4];
+        unsigned int length;
+        unsigned int n = foldUTF8( s, folded, &length );
+
+        if ( i + n >= size )
+        {
+            break;
+        }
+        for ( unsigned int j = 0; j < n; ++j )
+        {
+            if ( offsets != NULL )
+            {
+                offsets[ i ] = s - src;
+            }
+            dst[ i++ ] = folded[j];
+        }
+        s += length;
+    }
+
+    if ( offsets != NULL )
+    {
+        offsets[ i ] = s - src;
+    }
+    dst[ i ] = '\0';
+
+    return i;
+}
+
+/**
+ * @brief overwrite every multi-byte sequence that folds into a separator with
+ * spaces, so the tokenizer can treat it like any other separator, and the
+ * tokens either side remain valid UTF-8.
+ */
+void blankSeparatorsUTF8( char * s, int (* isSeparator)( unsigned char c ) )
+{
+    while ( *s != '\0' )
+    {
+        char folded[4];
+        unsigned int length;
+        unsigned int n = foldUTF8( s, folded, &length );
+
+        if ( length > 1 && n == 1 && isSeparator( folded[0] ) )
+        {
+            memset( s, ' ', length );
+        }
+        s += length;
+    }
+}
@@ -0,0 +1,18 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_UTF8_H
+#define DVR2PLEX_UTF8_H
+
+#include <stddef.h>
+
+/* enough room to fold a NAME_MAX name, as no sequence folds into more bytes than it occupies */
+#define kMaxFoldedName  ( NAME_MAX + 1 )
+
+         int  isASCII( string s, size_t length );
+unsigned int  foldUTF8( string s, char folded[4], unsigned int * length );
+      size_t  normalizeUTF8( string src, char * dst, size_t size, unsigned short * offsets );
+        void  blankSeparatorsUTF8( char * s, int (* isSeparator)( unsigned char c ) );
+
+#endif // DVR2PLEX_UTF8_H
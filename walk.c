@@ -0,0 +1,198 @@
+//
+// Created by paul on 10/19/26.
+//
+// Walk a directory tree using several threads, since a large library on
+// spinning disks (or over the network) spends nearly all its time waiting
+// on directory reads and inode lookups, which parallelise well. Directories
+// waiting to be read are kept on a shared stack; a thread that runs out of
+// work waits until either more directories are pushed, or every thread is
+// idle, at which point the walk is complete.
+//
+#define _GNU_SOURCE
+#include "dvr2plex.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "walk.h"
+
+#define kWalkMaxThreads 16
+#define kWalkMask       ( STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_INO | STATX_MTIME | STATX_SIZE )
+
+typedef struct sWalkDir {
+    struct sWalkDir * next;
+    char              path[];
+} tWalkDir;
+
+typedef struct {
+    tWalkDir      * pending;     // directories waiting to be read
+    unsigned int    busy;        // threads currently reading a directory
+    pthread_mutex_t mutex;
+    pthread_cond_t  wake;
+    pthread_mutex_t callbackMutex;
+    tWalkCallback   callback;
+    void          * context;
+} tWalk;
+
+static void pushDirectory( tWalk * walk, string path )
+{
+    size_t    length = strlen( path ) + 1;
+    tWalkDir * dir   = malloc( sizeof(tWalkDir) + length );
+
+    if ( dir == NULL )
+    {
+        fprintf( stderr, "### Error: unable to allocate memory for \'%s\' (%d: %s)\n",
+                 path, errno, strerror(errno) );
+        return;
+    }
+    memcpy( dir->path, path, length );
+
+    pthread_mutex_lock( &walk->mutex );
+    dir->next     = walk->pending;
+    walk->pending = dir;
+    pthread_cond_signal( &walk->wake );
+    pthread_mutex_unlock( &walk->mutex );
+}
+
+static void readDirectory( tWalk * walk, string path )
+{
+    char            temp[ PATH_MAX ];
+    struct statx    stx;
+    struct dirent * entry;
+
+    DIR * dir = opendir( path );
+    if ( dir == NULL )
+    {
+        fprintf( stderr, "### Error: unable to read directory \'%s\' (%d: %s)\n",
+                 path, errno, strerror(errno) );
+        return;
+    }
+
+    int fd = dirfd( dir );
+    while ( (entry = readdir( dir )) != NULL )
+    {
+        if ( entry->d_name[0] == '.'
+          && ( entry->d_name[1] == '\0' || ( entry->d_name[1] == '.' && entry->d_name[2] == '\0' ) ) )
+        {
+            continue;
+        }
+        if ( statx( fd, entry->d_name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, kWalkMask, &stx ) != 0 )
+        {
+            continue;   // vanished since readdir(), most likely
+        }
+
+        snprintf( temp, sizeof(temp), "%s/%s", path, entry->d_name );
+
+        tWalkEntry found = {
+            .path   = temp,
+            .device = makedev( stx.stx_dev_major, stx.stx_dev_minor ),
+            .inode  = stx.stx_ino,
+            .links  = stx.stx_nlink,
+            .mode   = stx.stx_mode,
+            .size   = stx.stx_size,
+            .mtime  = { stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec }
+        };
+
+        pthread_mutex_lock( &walk->callbackMutex );
+        walk->callback( walk->context, &found );
+        pthread_mutex_unlock( &walk->callbackMutex );
+
+        if ( S_ISDIR( stx.stx_mode ) )
+        {
+            pushDirectory( walk, temp );
+        }
+    }
+    closedir( dir );
+}
+
+static void * walkThread( void * arg )
+{
+    tWalk * walk = arg;
+
+    pthread_mutex_lock( &walk->mutex );
+    for (;;)
+    {
+        while ( walk->pending == NULL && walk->busy > 0 )
+        {
+            pthread_cond_wait( &walk->wake, &walk->mutex );
+        }
+        if ( walk->pending == NULL )
+        {
+            break;   // nothing left to read, and nobody reading anything that might add more
+        }
+
+        tWalkDir * dir = walk->pending;
+        walk->pending  = dir->next;
+        ++walk->busy;
+        pthread_mutex_unlock( &walk->mutex );
+
+        readDirectory( walk, dir->path );
+        free( dir );
+
+        pthread_mutex_lock( &walk->mutex );
+        if ( --walk->busy == 0 && walk->pending == NULL )
+        {
+            pthread_cond_broadcast( &walk->wake );
+        }
+    }
+    pthread_mutex_unlock( &walk->mutex );
+    return NULL;
+}
+
+/**
+ * @brief call 'callback' for everything below 'root' (but not root itself), using up to 'threads' threads
+ * @param threads 0 to pick a number based on the available processors
+ */
+int walkTree( string root, unsigned int threads, tWalkCallback callback, void * context )
+{
+    pthread_t thread[ kWalkMaxThreads ];
+    unsigned int started = 0;
+    tWalk walk;
+
+    if ( threads == 0 )
+    {
+        long n = sysconf( _SC_NPROCESSORS_ONLN );
+        threads = ( n > 0 ) ? (unsigned int)n * 2 : 4;   // mostly waiting on I/O, so oversubscribe
+    }
+    if ( threads > kWalkMaxThreads )
+    {
+        threads = kWalkMaxThreads;
+    }
+
+    memset( &walk, 0, sizeof(walk) );
+    pthread_mutex_init( &walk.mutex, NULL );
+    pthread_mutex_init( &walk.callbackMutex, NULL );
+    pthread_cond_init( &walk.wake, NULL );
+    walk.callback = callback;
+    walk.context  = context;
+
+    pushDirectory( &walk, root );
+
+    for ( unsigned int i = 1; i < threads; ++i )
+    {
+        if ( pthread_create( &thread[ started ], NULL, walkThread, &walk ) == 0 )
+        {
+            ++started;
+        }
+    }
+    walkThread( &walk );   // this thread does its share, too
+
+    for ( unsigned int i = 0; i < started; ++i )
+    {
+        pthread_join( thread[i], NULL );
+    }
+
+    pthread_cond_destroy( &walk.wake );
+    pthread_mutex_destroy( &walk.callbackMutex );
+    pthread_mutex_destroy( &walk.mutex );
+
+    return 0;
+}
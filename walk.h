@@ -0,0 +1,27 @@
+//
+// Created by paul on 10/19/26.
+//
+
+#ifndef DVR2PLEX_WALK_H
+#define DVR2PLEX_WALK_H
+
+#include <sys/types.h>
+#include <time.h>
+
+typedef struct {
+    string          path;
+    dev_t           device;
+    ino_t           inode;
+    nlink_t         links;
+    mode_t          mode;
+    off_t           size;
+    struct timespec mtime;
+} tWalkEntry;
+
+/* called once for every entry found, including directories. Calls are
+   serialized, so the callback doesn't need any locking of its own */
+typedef void (* tWalkCallback)( void * context, const tWalkEntry * entry );
+
+int walkTree( string root, unsigned int threads, tWalkCallback callback, void * context );
+
+#endif // DVR2PLEX_WALK_H